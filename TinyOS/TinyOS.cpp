@@ -1,573 +1,2241 @@
-﻿#include <windows.h>
+﻿#include <cstdarg>
+#include <cstdio>
 #include <iostream>
-#include <vector>
 #include <functional>
 #include <string>
-#include <unordered_map>
-#include <memory>
-#include <stdexcept>
-#include <queue>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "kernel.h"
 #include "TinyOS.h"
+#include "port.h"
+#include "mpscRing.h"
+#include "trace.h"
+#include "kernelLog.h"
+#include "tlsf.h"
 
-#include "userConfig.h"
+#include "kernelConfig.h"
 
+// 整形はせずに引数だけを取り込み、flushLogTinyOS でまとめて出力する
 void debug_printf(const char* format, ...)
 {
-    char buffer[1024];
+    if (!KLOG_ENABLED(KLOG_LEVEL_INFO, KLOG_CAT_USER)) return;
     va_list args;
     va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
+    LogWriteV(format, args);
     va_end(args);
+}
+
+// タスクごとのスタックサイズ（userConfig.h で変更できる）
+#ifndef TASK_STACK_SIZE
+#define TASK_STACK_SIZE		(64 * 1024)
+#endif
+
+// タスクのスタックを塗って使用量の最大値を測る（userConfig.h で変更できる）
+// 塗るとスタック全体が実メモリーを占めるので、タスクを大量に作るときは 0 にする
+#ifndef TASK_STACK_PAINT
+#define TASK_STACK_PAINT	1
+#endif
+
+// 1ティックあたりのディスパッチ回数の上限（userConfig.h で変更できる）
+#ifndef DISPATCH_BUDGET
+#define DISPATCH_BUDGET		64
+#endif
+
+// 非タスクからの要求をためておける数（2 のべき乗、userConfig.h で変更できる）
+#ifndef REQUEST_QUEUE_SIZE
+#define REQUEST_QUEUE_SIZE	64
+#endif
+
+// 侵入型の双方向リスト（リストの先頭もノードと同じ形）
+// 空のリストと、どこにもつながっていないノードは自分自身を指す
+struct Queue {
+	Queue* next;
+	Queue* prev;
+};
+
+static inline void QueueInit(Queue* queue) {
+	queue->next = queue->prev = queue;
+}
+
+static inline bool QueueEmpty(const Queue* queue) {
+	return queue->next == queue;
+}
 
-    OutputDebugStringA(buffer);
+// リストの末尾に追加する
+static inline void QueueInsert(Queue* queue, Queue* entry) {
+	entry->prev = queue->prev;
+	entry->next = queue;
+	queue->prev->next = entry;
+	queue->prev = entry;
 }
 
+// つながっているリストから外す（つながっていなくても良い）
+static inline void QueueDelete(Queue* entry) {
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	QueueInit(entry);
+}
+
+// from の全要素を空の to へ付け替える
+static inline void QueueMove(Queue* from, Queue* to) {
+	if (QueueEmpty(from)) {
+		QueueInit(to);
+		return;
+	}
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	QueueInit(from);
+}
+
+// タイマーイベント、満了時刻（絶対ティック）に callback(arg) が呼ばれる
+struct TimerEvent {
+	Queue node;				// タイマーホイールのスロットにつなぐ（先頭に置くこと）
+	SYSTIM expire;
+	void (*callback)(void*);
+	void* arg;
+};
+
+// タスクの実行統計（時刻と時間は PortTimestamp() のナノ秒）
+struct TaskStats {
+	UINT dispatchCount;
+	uint64_t runTime;
+	uint64_t waitTime[TNUM_TSTAT_WAIT];
+	uint64_t waitStart;		// 待ち状態に入った時刻
+	uint64_t readyStart;	// 待ちが解除された時刻（ディスパッチされたら 0 に戻す）
+	UINT latency[TNUM_TSTAT_LATENCY];
+};
+
 // タスク情報構造体
 struct TaskInfo {
-	HANDLE threadHandle;
-	DWORD threadId;
+	Queue node;				// レディーキューか待ちキューにつなぐ（先頭に置くこと）
+	PortContext context;	// 切り替え時のレジスタ・スタックの退避先
+	bool isFinished;		// タスク関数から抜け、二度と再開しない
+	ID tskid;
+	PRI priority;			// 小さいほど優先度が高い（TMIN_TPRI～TMAX_TPRI）
+	PRI basePriority;		// ミューテックスで引き上げる前の優先度
 	const char* taskName;
 	VP_INT taskData;
+	UINT stackSize;			// スタックのバイト数（ポートが実際に用意した大きさ）
 	bool isExist;
-	HANDLE excuteEvent;
 	bool isWaiting;
-	RELTIM dly_tim;
+	UINT waitReason;		// 待ち要因（TTW_*、待ち状態でなければ 0）
+	ER wercd;				// 待ち解除時に待っていたサービスコールが返す値
+	UINT wakeupCount;		// キューイングされた起床要求の数
+	TimerEvent timer;		// 時間待ち
 	// --- EVENT FLAG -->
 	FLGPTN waitptn;
 	MODE waitmode;
 	// <-- EVENT FLAG ---
-	// --- EVENT FLAG -->
+	// --- DATA QUEUE -->
 	VP_INT receptData;
-	// <-- EVENT FLAG ---
+	VP_INT sendData;
+	// <-- DATA QUEUE ---
+	// --- SEMAPHORE -->
+	UINT waitUnits;			// 獲得を待っている資源数
+	struct SemInfo* waitSemaphore;
+	// <-- SEMAPHORE ---
+	// --- MEMORY POOL -->
+	UINT waitSize;			// 可変長メモリープールに要求している大きさ
+	struct MplInfo* waitPool;
+	// <-- MEMORY POOL ---
+	// --- MUTEX -->
+	struct MtxInfo* waitMutex;	// 待っているミューテックス
+	Queue heldMutexes;		// ロックしている MtxInfo::node をつなぐ
+	// <-- MUTEX ---
 	TaskFunction taskFunction;
+	TaskStats stats;
 };
 
 // グローバル変数（ファイルスコープ）
-static std::vector<std::shared_ptr<TaskInfo>> tasks;
-static std::queue<std::shared_ptr<TaskInfo>> readyQueue;
-static std::queue<std::shared_ptr<TaskInfo>> waitTimeQueue;
-static HANDLE yieldEvent;
-static CRITICAL_SECTION criticalSection;
+// レディーキューは優先度ごとに持ち、空でない優先度をビットマップで管理する
+// （優先度 p のビットは 1 << (TMAX_TPRI - p)、先頭の 0 の数が最高優先度 - 1 になる）
+static Queue readyQueue[TMAX_TPRI];
+static uint32_t readyBitmap;
+static bool preemptRequest;	// 実行中タスクより高い優先度のタスクがレディーになった
+static UINT budgetOverrunTicks;	// ディスパッチ上限に達したまま終わった連続ティック数
+static std::atomic<void (*)()> wakeupHook;	// ティックレスで眠っているホストを起こす
+static PortContext dispatcherContext;
+static bool taskContext;		// running_task が実行中（ディスパッチャーや非タスクからの要求の処理中は false）
+static bool dispatchDisabled;	// DisableDispatch の区間
+static bool cpuLocked;			// LockCpu の区間
+
+// 非タスク（割り込みやホストの別スレッド）からのサービスコール要求
+// i* はここに積むだけで、カーネルの状態にはディスパッチャーのスレッドしか触らない
+enum RequestCode {
+	REQUEST_WAKEUP_TASK,
+	REQUEST_SET_FLAG,
+	REQUEST_SEND_DATA_QUEUE,
+	REQUEST_SIGNAL_SEMAPHORE,	// 返却する資源数は ptn に入れる
+};
+
+struct ServiceRequest {
+	RequestCode code;
+	ID id;
+	FLGPTN ptn;
+	VP_INT data;
+};
 
+static MpscRing<ServiceRequest, REQUEST_QUEUE_SIZE> requestQueue;
+static void DrainRequests();
+static void WaitCancelled(TaskInfo* task, UINT waitReason);
+static void MtxReleaseAll(TaskInfo* task);
 
 
 
-// ContextManagerクラス - IDでContextを登録・取得する
+
+// ContextManagerクラス - IDをそのまま添字にした固定長の管理ブロック表
+// （IDは userConfig.h の列挙子なので 0～CONTEXT_MAX-1 に詰まっている）
 template <typename T, int CONTEXT_MAX>
 class ContextManager {
 public:
-	// コンテキストをIDに基づいて登録
-	void registerContext(int id, std::shared_ptr<T> context) {
-		if (id < 0 || id >= CONTEXT_MAX) {
-			throw std::out_of_range("Invalid ID");
-		}
-		contexts_[id] = context;
+	static constexpr bool isValidId(int id) {
+		return id >= 0 && id < CONTEXT_MAX;
 	}
 
-	// IDに基づいてコンテキストを取得
-	std::shared_ptr<T> getContext(int id) const {
-		auto it = contexts_.find(id);
-		if (it != contexts_.end()) {
-			return it->second;
-		}
-		else {
-			throw std::out_of_range("Context not found for given ID");
+	// IDに基づいて管理ブロックを生成済みにする
+	ER createContext(int id, T** context) {
+		if (!isValidId(id)) return E_ID;
+		if (created_[id]) return E_OBJ;
+		created_[id] = true;
+		*context = &contexts_[id];
+		return E_OK;
+	}
+
+	void deleteContext(int id) {
+		if (isValidId(id)) created_[id] = false;
+	}
+
+	// IDに基づいて管理ブロックを取得
+	ER getContext(int id, T** context) {
+		if (!isValidId(id)) return E_ID;
+		if (!created_[id]) return E_NOEXS;
+		*context = &contexts_[id];
+		return E_OK;
+	}
+
+	// IDが定数の場合は範囲をコンパイル時に検査する（未生成なら nullptr）
+	template <int id>
+	T* getContext() {
+		static_assert(isValidId(id), "ID is out of range");
+		return created_[id] ? &contexts_[id] : nullptr;
+	}
+
+	// 生成済みの管理ブロックを ID 順に巡回する
+	template <typename F>
+	void forEach(F f) {
+		for (int id = 0; id < CONTEXT_MAX; id++) {
+			if (created_[id]) f(&contexts_[id]);
 		}
 	}
 
 private:
-	// コンテキストを格納するマップ
-	std::unordered_map<int, std::shared_ptr<T>> contexts_;
+	// ID を一つも定義しない種類でも配列の長さが 0 にならないようにする
+	T contexts_[CONTEXT_MAX > 0 ? CONTEXT_MAX : 1];
+	bool created_[CONTEXT_MAX > 0 ? CONTEXT_MAX : 1];
 };
 
 static ContextManager<TaskInfo, ID_TASK_MAX> task_manager;
 
 // 自タスクを指定した場合に参照するタスク管理情報を維持（非タスクでは使用禁止）
-static std::shared_ptr<TaskInfo> running_task;
+static TaskInfo* running_task;
+
+// トレースに記録する呼び出し元（タスク以外なら TSK_NONE）
+static inline ID CurrentSource() {
+	return taskContext ? running_task->tskid : TSK_NONE;
+}
+
+static inline int CountLeadingZeros(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, bits);
+	return 31 - (int)index;
+#else
+	return __builtin_clz(bits);
+#endif
+}
+
+static inline uint32_t ReadyBit(PRI priority) {
+	return 1u << (TMAX_TPRI - priority);
+}
+
+// タスクをその優先度のレディーキュー末尾に追加する
+static void ReadyTask(TaskInfo* task) {
+	QueueInsert(&readyQueue[task->priority - TMIN_TPRI], &task->node);
+	readyBitmap |= ReadyBit(task->priority);
+	// 実行中タスクより優先度が高ければ、実行中タスクが実行権を譲ったときに横取りさせる
+	if (running_task && task->priority < running_task->priority) preemptRequest = true;
+}
+
+// 横取りされたタスクは同じ優先度の先頭に戻し、次に最初に実行されるようにする
+static void ReadyTaskHead(TaskInfo* task) {
+	QueueInsert(readyQueue[task->priority - TMIN_TPRI].next, &task->node);
+	readyBitmap |= ReadyBit(task->priority);
+}
+
+// 待ち要因を TaskStats::waitTime の添字にする（統計を取らない要因は -1）
+static inline int WaitStatIndex(UINT waitReason) {
+	switch (waitReason) {
+	case TTW_SLP:	return TSTAT_WAIT_SLP;
+	case TTW_DLY:	return TSTAT_WAIT_DLY;
+	case TTW_SEM:	return TSTAT_WAIT_SEM;
+	case TTW_FLG:	return TSTAT_WAIT_FLG;
+	case TTW_SDTQ:	return TSTAT_WAIT_SDTQ;
+	case TTW_RDTQ:	return TSTAT_WAIT_RDTQ;
+	case TTW_MTX:	return TSTAT_WAIT_MTX;
+	case TTW_MPF:	return TSTAT_WAIT_MPF;
+	case TTW_MPL:	return TSTAT_WAIT_MPL;
+	default:		return -1;
+	}
+}
+
+// 待ち解除からディスパッチまでの時間を度数分布の区間にする
+static inline int LatencyBin(uint64_t ns) {
+	uint64_t us = ns / 1000;
+	int bin = 0;
+	while (us && bin < TNUM_TSTAT_LATENCY - 1) {
+		us >>= 1;
+		bin++;
+	}
+	return bin;
+}
+
+// レディーキューから外す（実行中でどこにもつながっていなくても良い）
+static void UnreadyTask(TaskInfo* task) {
+	Queue* queue = &readyQueue[task->priority - TMIN_TPRI];
+	QueueDelete(&task->node);
+	if (QueueEmpty(queue)) readyBitmap &= ~ReadyBit(task->priority);
+}
+
+// 最高優先度のレディーキュー先頭のタスクを取り出す（空なら nullptr）
+static TaskInfo* TakeHighestReadyTask() {
+	if (!readyBitmap) return nullptr;
+	int index = CountLeadingZeros(readyBitmap);
+	Queue* queue = &readyQueue[index];
+	TaskInfo* task = reinterpret_cast<TaskInfo*>(queue->next);
+	QueueDelete(&task->node);
+	if (QueueEmpty(queue)) readyBitmap &= ~ReadyBit(index + TMIN_TPRI);
+	return task;
+}
+
+// ------------------------------------------
+// 階層型タイマーホイール
+//   レベル0 は 1 ティック単位の 256 スロット、上位の 3 レベルはそれぞれ 64 スロットで、
+//   1 スロットが下位レベル一周分に当たる。ティックごとに触るのはレベル0 の 1 スロット
+//   （このティックで満了するタイマーだけ）で、下位が一周したときだけ上位の 1 スロットを降ろす。
+
+#define TIMER_L0_BITS	8
+#define TIMER_LN_BITS	6
+#define TIMER_LEVELS	4
+#define TIMER_L0_SIZE	(1u << TIMER_L0_BITS)
+#define TIMER_LN_SIZE	(1u << TIMER_LN_BITS)
+#define TIMER_NONE		(~(SYSTIM)0)
+
+static Queue timerWheel0[TIMER_L0_SIZE];
+static Queue timerWheelN[TIMER_LEVELS - 1][TIMER_LN_SIZE];
+static SYSTIM systemTick;	// 処理済みのティック数（次に処理するのは systemTick + 1）
+
+static void TimerInitialize() {
+	for (Queue& slot : timerWheel0) QueueInit(&slot);
+	for (auto& level : timerWheelN) {
+		for (Queue& slot : level) QueueInit(&slot);
+	}
+	systemTick = 0;
+}
+
+// 満了時刻に応じたスロットにつなぐ（過ぎている場合は次のティックで満了させる）
+static void TimerInsert(TimerEvent* event) {
+	SYSTIM next = systemTick + 1;
+	SYSTIM expire = (event->expire < next) ? next : event->expire;
+	SYSTIM delta = expire - next;
+	Queue* slot;
+	if (delta < TIMER_L0_SIZE) {
+		slot = &timerWheel0[expire & (TIMER_L0_SIZE - 1)];
+	}
+	else {
+		int level = 0;
+		unsigned shift = TIMER_L0_BITS;
+		while (level < TIMER_LEVELS - 2 && delta >= (1ull << (shift + TIMER_LN_BITS))) {
+			level++;
+			shift += TIMER_LN_BITS;
+		}
+		// ホイール全体より先のものは最上位の最後のスロットに置き、降ろすたびに置き直す
+		if (delta >= (1ull << (shift + TIMER_LN_BITS))) {
+			expire = next + (1ull << (shift + TIMER_LN_BITS)) - 1;
+		}
+		slot = &timerWheelN[level][(expire >> shift) & (TIMER_LN_SIZE - 1)];
+	}
+	QueueInsert(slot, &event->node);
+}
+
+static void TimerStart(TimerEvent* event, SYSTIM expire) {
+	QueueDelete(&event->node);
+	event->expire = expire;
+	TimerInsert(event);
+}
+
+static void TimerStop(TimerEvent* event) {
+	QueueDelete(&event->node);
+}
+
+// 上位レベルのスロットの中身を、満了時刻に応じて下位レベルへ置き直す
+static void TimerCascade(int level, unsigned index) {
+	Queue list;
+	QueueMove(&timerWheelN[level][index], &list);
+	while (!QueueEmpty(&list)) {
+		Queue* entry = list.next;
+		QueueDelete(entry);
+		TimerInsert(reinterpret_cast<TimerEvent*>(entry));
+	}
+}
+
+// ティックを 1 つ進め、満了したタイマーの callback を呼ぶ
+static void TimerTick() {
+	// 降ろしたタイマーがこのティックで満了する場合もあるので、systemTick は取り外した後に進める
+	SYSTIM tick = systemTick + 1;
+	unsigned index = tick & (TIMER_L0_SIZE - 1);
+	if (index == 0) {
+		unsigned shift = TIMER_L0_BITS;
+		for (int level = 0; level < TIMER_LEVELS - 1; level++, shift += TIMER_LN_BITS) {
+			unsigned upper = (tick >> shift) & (TIMER_LN_SIZE - 1);
+			TimerCascade(level, upper);
+			if (upper != 0) break;	// さらに上位が一周したときだけ続ける
+		}
+	}
+
+	// callback の中で同じスロットにつなぎ直されても良いよう、先に取り外しておく
+	Queue expired;
+	QueueMove(&timerWheel0[index], &expired);
+	systemTick = tick;
+	while (!QueueEmpty(&expired)) {
+		TimerEvent* event = reinterpret_cast<TimerEvent*>(expired.next);
+		QueueDelete(&event->node);
+		event->callback(event->arg);
+	}
+}
+
+// 次にタイマー処理（満了、または上位レベルからの降ろし）が必要になるティックの下限を返す
+// タイマーが一つも無ければ TIMER_NONE
+static SYSTIM TimerNextEvent() {
+	SYSTIM next = systemTick + 1;
+	SYSTIM earliest = TIMER_NONE;
+	for (unsigned i = 0; i < TIMER_L0_SIZE; i++) {
+		if (!QueueEmpty(&timerWheel0[(next + i) & (TIMER_L0_SIZE - 1)])) {
+			earliest = next + i;
+			break;
+		}
+	}
+	// 上位レベルのスロットは、それより下位のビットがすべて 0 になるティックで降ろされる
+	unsigned shift = TIMER_L0_BITS;
+	for (int level = 0; level < TIMER_LEVELS - 1; level++, shift += TIMER_LN_BITS) {
+		SYSTIM boundary = (next + (1ull << shift) - 1) >> shift;
+		for (unsigned i = 0; i < TIMER_LN_SIZE; i++) {
+			SYSTIM tick = (boundary + i) << shift;
+			if (tick >= earliest) break;
+			if (!QueueEmpty(&timerWheelN[level][(boundary + i) & (TIMER_LN_SIZE - 1)])) {
+				earliest = tick;
+				break;
+			}
+		}
+	}
+	return earliest;
+}
+
+// target までティックを進める（ティックレスで止まっていた分は、処理の要らない区間を飛ばす）
+static void TimerAdvance(SYSTIM target) {
+	while (systemTick < target) {
+		if (target - systemTick > 1) {
+			SYSTIM event = TimerNextEvent();
+			if (event > target) {
+				systemTick = target;
+				return;
+			}
+			systemTick = event - 1;
+		}
+		TimerTick();
+	}
+}
+
+// ------------------------------------------
 
 // 実行タスクが存在するかどうかを返す
 bool isTaskExist() {
 	return running_task->isExist;
 }
 
+// 終了要求済みのタスク（cleanupTinyOS で最後まで走らせている間を含む）からのサービスコールは、
+// オブジェクトに触れずに E_RLWAI を返す（待ちに入る呼び出しが待たずに E_RLWAI で戻るのと同じ扱い）
+static inline bool CallerDeleted() {
+	return taskContext && !running_task->isExist;
+}
+
 // スケジューラー（ディスパッチャー）関数、一定間隔（Tick時間）で呼ばれることが前提
 void StartDispatcher() {
-	// 時間待ち
-	if (!waitTimeQueue.empty()) {
-		for (size_t q_len = waitTimeQueue.size(); q_len; q_len--) {
-			std::shared_ptr<TaskInfo> wai_tim_tsk = waitTimeQueue.front();
-			waitTimeQueue.pop();
-			if (!--wai_tim_tsk->dly_tim) {
-				wai_tim_tsk->isWaiting = false;
-				readyQueue.push(wai_tim_tsk);
-				debug_printf("Wakeup task: %s\n", wai_tim_tsk->taskName);
-			}
-			else {
-				waitTimeQueue.push(wai_tim_tsk);
-			}
+	AdvanceDispatcher(1);
+}
+
+// ticks ティック分の時間をまとめて進めてからディスパッチする（ticks == 0 ならディスパッチのみ）
+void AdvanceDispatcher(SYSTIM ticks) {
+	// 時間待ち（満了するタイマーだけを処理する）
+	TimerAdvance(systemTick + ticks);
+
+	// 非タスクからの要求をまとめて処理する（タスク実行中に届いたものは切り替えのたびに処理する）
+	DrainRequests();
+
+	// レディーキューが空になるまで実行可能タスクを回す
+	// （ティックの超過を抑えるため、DISPATCH_BUDGET 回で打ち切って残りは次のティックに回す）
+	UINT dispatched = 0;
+	while (readyBitmap && dispatched < DISPATCH_BUDGET) {
+		// 終了したタスクや待ち状態のタスクはその場でキューから外れているので、取り出せば必ず実行できる
+		running_task = TakeHighestReadyTask();
+		dispatched++;
+		preemptRequest = false;
+		KLOG_DEBUG(KLOG_CAT_SCHED, "Dispatching: %s\n", running_task->taskName);
+		TRACE(TRACE_DISPATCH, running_task->tskid, TSK_NONE, 0, 0);
+		TaskStats* stats = &running_task->stats;
+		uint64_t start = PortTimestamp();
+		stats->dispatchCount++;
+		if (stats->readyStart) {
+			stats->latency[LatencyBin(start - stats->readyStart)]++;
+			stats->readyStart = 0;
 		}
+		// タスクに実行権を渡す
+		taskContext = true;
+		PortSwitchContext(&dispatcherContext, &running_task->context);
+		taskContext = false;
+		// 区間は待ちに入ると閉じられないので、残っているのは区間の中で終了したタスクだけ
+		dispatchDisabled = false;
+		cpuLocked = false;
+		uint64_t end = PortTimestamp();
+		stats->runTime += end - start;
+		if (running_task->isWaiting) stats->waitStart = end;
+		if (!running_task->isExist) {
+			TRACE(TRACE_EXIT, running_task->tskid, TSK_NONE, 0, 0);
+		}
+		else if (running_task->isWaiting) {
+			TRACE(TRACE_BLOCK, running_task->tskid, TSK_NONE, running_task->waitReason, 0);
+		}
+		else {
+			TRACE(TRACE_YIELD, running_task->tskid, TSK_NONE, 0, preemptRequest);
+			// 再度レディーキューに追加（横取りされた場合は同じ優先度の先頭へ）
+			if (preemptRequest) ReadyTaskHead(running_task);
+			else ReadyTask(running_task);
+		}
+		DrainRequests();
 	}
 
-	// 実行可能タスクを一周回す
-	if (!readyQueue.empty()) {	// TODO: レディーキューが空になるまで繰り返す
-		running_task = readyQueue.front();
-		readyQueue.pop();
-		if (running_task->isExist && !running_task->isWaiting) {
-			debug_printf("Dispatching: %s\n", running_task->taskName);
-			// タスクに実行権を渡す
-			SetEvent(running_task->excuteEvent);
-			WaitForSingleObject(yieldEvent, INFINITE);
-			if (!running_task->isWaiting) readyQueue.push(running_task); // 再度レディーキューに追加
+	// 上限超過は続いている間に何度も出さず、始まりと終わりだけ報告する
+	if (readyBitmap) {
+		if (budgetOverrunTicks++ == 0) {
+			KLOG_WARN(KLOG_CAT_SCHED, "Dispatch budget (%d) exceeded, deferring ready tasks to the next tick\n", DISPATCH_BUDGET);
 		}
 	}
+	else if (budgetOverrunTicks) {
+		KLOG_INFO(KLOG_CAT_SCHED, "Dispatch budget recovered after %u tick(s)\n", budgetOverrunTicks);
+		budgetOverrunTicks = 0;
+	}
+}
+
+SYSTIM GetIdleTicks() {
+	SYSTIM ticks;
+	if (readyBitmap || !requestQueue.empty()) {
+		ticks = 1;	// 上限超過で残ったタスクや、フックを設定する前に届いた要求は次のティックで
+	}
+	else {
+		SYSTIM event = TimerNextEvent();
+		ticks = (event == TIMER_NONE) ? IDLE_FOREVER : event - systemTick;
+	}
+	return ticks;
+}
+
+void setWakeupHookTinyOS(void (*hook)()) {
+	wakeupHook.store(hook);
 }
 
 // タスクの実行権を譲る関数（リネーム済み）
 static void TaskYield() {
-	// 現在のタスクが他のタスクに実行権を譲る
-	SetEvent(yieldEvent);
-	WaitForSingleObject(running_task->excuteEvent, INFINITE);
+	// 現在のタスクが他のタスクに実行権を譲る（ディスパッチャーへ直接切り替える）
+	PortSwitchContext(&running_task->context, &dispatcherContext);
+}
+
+// 待ちを解除するかもしれない呼び出しの最後に呼ぶ
+// 実行中タスクより優先度の高いタスクがレディーのときだけ実行権を譲る（同じ優先度には譲らない）。
+// ディスパッチ禁止・CPU ロック中は譲らず、区間の終わりで改めて判断する
+static void Reschedule() {
+	if (!running_task->isExist || dispatchDisabled || cpuLocked) return;
+	if (readyBitmap && CountLeadingZeros(readyBitmap) + TMIN_TPRI < running_task->priority) TaskYield();
 }
 
 // ------------------------------------------
 
-// なぜかラムダ関数が使えないので、スレッド関数を定義
-static DWORD WINAPI TaskThreadFunction(void* param) {
-	// 生ポインタを shared_ptr に再構築（ちょっとここ難しい！分からん！後で分かるんかな？）
-	std::shared_ptr<TaskInfo>* taskInfoPtr = static_cast<std::shared_ptr<TaskInfo>*>(param);
-	std::shared_ptr<TaskInfo> taskInfo = *taskInfoPtr;
+// タスクコンテキストの入口、ディスパッチャーから初めて切り替えられたときに呼ばれる
+static void TaskEntry(void* param) {
+	// TaskInfo は task_manager の表の中にあり、動くことはない
+	TaskInfo* taskInfo = static_cast<TaskInfo*>(param);
 	while (taskInfo->isExist) {
-		// レディーキューに接続する
-		readyQueue.push(taskInfo);
-		WaitForSingleObject(taskInfo->excuteEvent, INFINITE);
 		// ユーザー定義のタスク関数を実行
-		debug_printf("Task %s is running\n", taskInfo->taskName);
+		KLOG_DEBUG(KLOG_CAT_TASK, "Task %s is running\n", taskInfo->taskName);
 		taskInfo->taskFunction(taskInfo->taskData);
+		// タスク関数から戻った場合は一度実行権を譲ってから再実行する
+		if (taskInfo->isExist) TaskYield();
 	}
-	return 0;
+	// コンテキストの入口からは戻れないので、終了を記録してディスパッチャーに戻る
+	taskInfo->isFinished = true;
+	PortSwitchContext(&taskInfo->context, &dispatcherContext);
 }
 
 static size_t task_counter = 0;
 
-static void ActivateTask(std::shared_ptr<TaskInfo> taskinfo) {
+// 自タスクを待ち状態にする（waitQueue が nullptr なら待ちキューにはつながない）
+static void WaitTask(UINT waitReason, Queue* waitQueue) {
+	running_task->isWaiting = true;
+	running_task->waitReason = waitReason;
+	running_task->wercd = E_OK;
+	if (waitQueue) QueueInsert(waitQueue, &running_task->node);
+}
+
+// タイムアウト付きで待ち状態にする（TMO_FEVR でなければ tmout ティック目に E_TMOUT で解除する）
+static void WaitTaskTimeout(UINT waitReason, Queue* waitQueue, TMO tmout) {
+	WaitTask(waitReason, waitQueue);
+	if (tmout != TMO_FEVR) TimerStart(&running_task->timer, systemTick + tmout);
+}
+
+// 待ち状態を解除してレディーキューに追加する（待ちキューとタイマーからはその場で外す）
+static void ReleaseWait(TaskInfo* task, ER ercd) {
+	TRACE(TRACE_WAKEUP, task->tskid, CurrentSource(), task->waitReason, static_cast<UINT>(ercd));
+	uint64_t now = PortTimestamp();
+	int index = WaitStatIndex(task->waitReason);
+	if (index >= 0) task->stats.waitTime[index] += now - task->stats.waitStart;
+	task->stats.readyStart = now;
+	QueueDelete(&task->node);
+	TimerStop(&task->timer);
+	task->isWaiting = false;
+	task->waitReason = 0;
+	task->wercd = ercd;
+	ReadyTask(task);
+}
+
+static void ActivateTask(TaskInfo* taskinfo) {
 	if (taskinfo->isExist) {
 		if (taskinfo->isWaiting) {
-			taskinfo->isWaiting = false;
-			readyQueue.push(taskinfo); // レディーキューに追加
+			// 待っていたオブジェクトの後始末（優先度継承の解除、後続の待ちタスクへの割り当て）も行う
+			UINT waitReason = taskinfo->waitReason;
+			ReleaseWait(taskinfo, E_RLWAI); // レディーキューに追加
+			WaitCancelled(taskinfo, waitReason);
 		}
 	}
 }
 
-static void DeleteTask(std::shared_ptr<TaskInfo> taskinfo) {
+static void DeleteTask(TaskInfo* taskinfo) {
 	if (taskinfo->isExist) {
 		taskinfo->isExist = false;
+		// 待ちキュー・レディーキュー・タイマーから外し、以後ディスパッチされないようにする
+		if (taskinfo->isWaiting) {
+			QueueDelete(&taskinfo->node);
+			taskinfo->wercd = E_RLWAI;
+			WaitCancelled(taskinfo, taskinfo->waitReason);
+		}
+		else {
+			UnreadyTask(taskinfo);
+		}
+		TimerStop(&taskinfo->timer);
+		MtxReleaseAll(taskinfo);
 		task_counter--;
 	}
 }
 
+// 時間待ちの満了（DelayTask なら正常終了、それ以外の待ちはタイムアウト）
+static void WaitTimeout(void* arg) {
+	TaskInfo* task = static_cast<TaskInfo*>(arg);
+	TRACE(TRACE_TIMER_EXPIRE, task->tskid, TSK_NONE, 0, 0);
+	UINT waitReason = task->waitReason;
+	ReleaseWait(task, (waitReason == TTW_DLY) ? E_OK : E_TMOUT);
+	WaitCancelled(task, waitReason);
+	KLOG_DEBUG(KLOG_CAT_TASK, "Wakeup task: %s\n", task->taskName);
+}
+
 // ユーザー定義タスクの生成関数
-void CreateTask(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData) {
-	std::shared_ptr<TaskInfo> taskInfo = std::make_shared<TaskInfo>();
+ER CreateTask(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData, PRI itskpri) {
+	return CreateTaskStack(tskid, name, taskFunction, taskData, itskpri, 0, 0, NULL);
+}
+
+ER CreateTaskStack(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData, PRI itskpri,
+	ATR tskatr, UINT stksz, VP stk) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (itskpri < TMIN_TPRI || itskpri > TMAX_TPRI) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Invalid priority %d for %s\n", itskpri, name);
+		return E_PAR;
+	}
+	if (stksz == 0) stksz = TASK_STACK_SIZE;
+	if ((tskatr & ~TA_GUARD) || stksz < PORT_STACK_MIN) return E_PAR;
+	if (stk && ((tskatr & TA_GUARD) || reinterpret_cast<uintptr_t>(stk) % sizeof(void*))) return E_PAR;
+#ifndef PORT_USER_STACK
+	if (stk) return E_NOSPT;
+#endif
+	TaskInfo* taskInfo;
+	ER ercd = task_manager.createContext(tskid, &taskInfo);
+	if (ercd != E_OK) return ercd;
+
+	taskInfo->tskid = tskid;
+	taskInfo->priority = itskpri;
+	taskInfo->basePriority = itskpri;
 	taskInfo->taskName = name;
 	taskInfo->taskData = taskData;
 	taskInfo->isExist = true;
 	taskInfo->isWaiting = true;
-	taskInfo->taskFunction = std::move(taskFunction);
-	taskInfo->excuteEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-
-	// shared_ptr を格納するためのポインタを用意
-	auto taskInfoPtr = new std::shared_ptr<TaskInfo>(taskInfo);
-
-	task_manager.registerContext(tskid, taskInfo);
-
-	taskInfo->threadHandle = CreateThread(
-		nullptr,
-		0,
-		TaskThreadFunction,
-		taskInfoPtr,
-		0,
-		&taskInfo->threadId
-		);
-
-	if (taskInfo->threadHandle == nullptr) {
-		debug_printf("Failed to create thread for %s\n", name);
-		return;
+	taskInfo->waitReason = 0;
+	taskInfo->wakeupCount = 0;
+	taskInfo->taskFunction = taskFunction;
+	taskInfo->isFinished = false;
+	taskInfo->stats = TaskStats();
+	QueueInit(&taskInfo->node);
+	QueueInit(&taskInfo->heldMutexes);
+	QueueInit(&taskInfo->timer.node);
+	taskInfo->timer.callback = WaitTimeout;
+	taskInfo->timer.arg = taskInfo;
+
+	unsigned flags = (TASK_STACK_PAINT ? PORT_STACK_PAINT : 0) | ((tskatr & TA_GUARD) ? PORT_STACK_GUARD : 0);
+	size_t stackSize;
+	if (!PortCreateContext(&taskInfo->context, stk, stksz, flags, TaskEntry, taskInfo, &stackSize)) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to create context for %s\n", name);
+		task_manager.deleteContext(tskid);
+		return E_NOMEM;
 	}
+	taskInfo->stackSize = static_cast<UINT>(stackSize);
 
-	tasks.push_back(taskInfo);
 	task_counter++;
 
 	// TODO: 起動時ACTフラグがあれれば、タスクを起動
 	ActivateTask(taskInfo);
+	return E_OK;
+}
+
+int exportTraceTinyOS(const char* path) {
+	FILE* fp = fopen(path, "w");
+	if (!fp) return -1;
+	bool ok = TraceExportChrome(fp, [](ID tskid) -> const char* {
+		TaskInfo* task;
+		return (task_manager.getContext(tskid, &task) == E_OK) ? task->taskName : nullptr;
+	});
+	if (fclose(fp) != 0) ok = false;
+	return ok ? 0 : -1;
 }
 
 void ViewTaskInfo() {
-	debug_printf("Task Name\tTask ID\t\tTask waiting\n");
-	debug_printf("----------------------------------------\n");
-	for (auto& task : tasks) {
-		debug_printf("%s\t%d\t\t%s\n", task->taskName, task->threadId, (task->isWaiting ? "Yes" : "No"));
-	}
-	debug_printf("----------------------------------------\n");
+	debug_printf("Task Name\tTask ID\t\tPriority\tTask waiting\tDispatch\tRun (us)\tStack used\n");
+	debug_printf("----------------------------------------------------------------------------------------\n");
+	task_manager.forEach([](TaskInfo* task) {
+		// 引数は一度に KLOG_MAX_ARGS 個までなので、行を二つに分けて出す
+		debug_printf("%s\t%d\t\t%d\t\t%s\t\t", task->taskName, task->tskid, task->priority, (task->isWaiting ? "Yes" : "No"));
+		debug_printf("%u\t\t%llu\t\t%zu\n", task->stats.dispatchCount, static_cast<unsigned long long>(task->stats.runTime / 1000), PortStackUsed(&task->context));
+	});
+	debug_printf("----------------------------------------------------------------------------------------\n");
 }
 
 // ------------------------------------------
 
-void ActionTask(ID tskid) {
-	std::shared_ptr<TaskInfo> taskinfo = task_manager.getContext(tskid);
+ER ActionTask(ID tskid) {
+	if (CallerDeleted()) return E_RLWAI;
+	TaskInfo* taskinfo;
+	ER ercd = task_manager.getContext(tskid, &taskinfo);
+	if (ercd != E_OK) return ercd;
 	ActivateTask(taskinfo);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+	Reschedule();
+	return E_OK;
 }
 
-void TermitTask(ID tskid) {
-	std::shared_ptr<TaskInfo> taskinfo = task_manager.getContext(tskid);
+ER TermitTask(ID tskid) {
+	if (CallerDeleted()) return E_RLWAI;
+	TaskInfo* taskinfo;
+	ER ercd = task_manager.getContext(tskid, &taskinfo);
+	if (ercd != E_OK) return ercd;
 	DeleteTask(taskinfo);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+	Reschedule();
+	return E_OK;
 }
 
-void SleepTask() {
-	if (!running_task->isExist) return; // 終了したタスクはスリープにすぐ戻る
-	running_task->isWaiting = true;
+// 起床要求が無ければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER TaskSleep(TMO tmout) {
+	if (tmout < TMO_FEVR) return E_PAR;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクはスリープにすぐ戻る
+	// 先に起床要求が来ていれば、それを一つ消費して待たずに戻る
+	if (running_task->wakeupCount) {
+		running_task->wakeupCount--;
+		return E_OK;
+	}
+	if (tmout == TMO_POL) return E_TMOUT;
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+	WaitTaskTimeout(TTW_SLP, nullptr, tmout);
 	TaskYield(); // 実行権を譲る
+	return running_task->wercd;
+}
+
+ER SleepTask() {
+	if (CallerDeleted()) return E_RLWAI;
+	return TaskSleep(TMO_FEVR);
 }
 
-void iWakeupTask(ID tskid) {
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
-	std::shared_ptr<TaskInfo> taskinfo = task_manager.getContext(tskid);
-	taskinfo->isWaiting = false;
-	readyQueue.push(taskinfo); // レディーキューに追加
-	/* <==== Critical */ LeaveCriticalSection(&criticalSection);
+ER tSleepTask(TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return TaskSleep(tmout);
 }
 
-void WakeupTask(ID tskid) {
-	iWakeupTask(tskid);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+// 非タスクからの要求をディスパッチャーに渡し、ティックレスで眠っているホストを起こす
+// （どのスレッド・シグナルハンドラーから呼ばれても良い）
+static ER PostRequest(RequestCode code, ID id, FLGPTN ptn, VP_INT data) {
+	ServiceRequest request = { code, id, ptn, data };
+	if (!requestQueue.push(request)) return E_QOVR;
+	void (*hook)() = wakeupHook.load();
+	if (hook) hook();
+	return E_OK;
 }
 
-void DelayTask(RELTIM dlytim) {
-	if (dlytim) {
-		running_task->isWaiting = true; // 自タスクを待ち状態にする
-		running_task->dly_tim = dlytim;
-		waitTimeQueue.push(running_task);
+static ER TaskWakeup(TaskInfo* taskinfo) {
+	ER ercd = E_OK;
+	if (!taskinfo->isExist) {
+		ercd = E_OBJ;
 	}
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+	else if (taskinfo->isWaiting && taskinfo->waitReason == TTW_SLP) {
+		ReleaseWait(taskinfo, E_OK); // レディーキューに追加
+	}
+	else if (taskinfo->wakeupCount < TMAX_WUPCNT) {
+		taskinfo->wakeupCount++;	// スリープしていなければ起床要求をためておく
+	}
+	else {
+		ercd = E_QOVR;
+	}
+	return ercd;
+}
+
+// 結果はディスパッチャーが要求を処理するときに決まる（ここで返すのは ID の検査と要求の受付まで）
+ER iWakeupTask(ID tskid) {
+	if (!task_manager.isValidId(tskid)) return E_ID;
+	return PostRequest(REQUEST_WAKEUP_TASK, tskid, 0, nullptr);
+}
+
+ER WakeupTask(ID tskid) {
+	if (CallerDeleted()) return E_RLWAI;
+	TaskInfo* taskinfo;
+	ER ercd = task_manager.getContext(tskid, &taskinfo);
+	if (ercd != E_OK) return ercd;
+	ercd = TaskWakeup(taskinfo);
+	if (ercd != E_OK) return ercd;
+	Reschedule();
+	return E_OK;
+}
+
+ER DelayTask(RELTIM dlytim) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクはすぐに戻る
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では実行権を譲れない
+	if (!dlytim) {
+		TaskYield(); // 実行権を譲るだけ
+		return E_OK;
+	}
+	WaitTask(TTW_DLY, nullptr); // 自タスクを待ち状態にする
+	// 次のティックを 1 として dlytim ティック目に満了させる
+	TimerStart(&running_task->timer, systemTick + dlytim);
+	TaskYield(); // 実行権を譲る
+	return running_task->wercd;
+}
+
+// 区間は入れ子にせず、二度目の DisableDispatch / LockCpu は何もしない
+// 非タスク（ハンドラー）から呼ぶと E_CTX
+ER DisableDispatch() {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!taskContext) return E_CTX;
+	dispatchDisabled = true;
+	return E_OK;
+}
+
+ER EnableDispatch() {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!taskContext) return E_CTX;
+	dispatchDisabled = false;
+	Reschedule();	// 区間の中でレディーになったタスクの分をまとめて判断する
+	return E_OK;
+}
+
+// 非タスクの処理（i* の要求とハンドラー）はもともとタスクの実行中には動かないので、
+// CPU ロックはディスパッチ禁止と同じく実行権の譲渡を区間の終わりまで保留する（二つは別々に解除する）
+ER LockCpu() {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!taskContext) return E_CTX;
+	cpuLocked = true;
+	return E_OK;
+}
+
+ER UnlockCpu() {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!taskContext) return E_CTX;
+	cpuLocked = false;
+	Reschedule();
+	return E_OK;
+}
+
+ER ReferenceTask(ID tskid, T_RTSK *pk_rtsk) {
+	TaskInfo* taskinfo;
+	ER ercd = task_manager.getContext(tskid, &taskinfo);
+	if (ercd != E_OK) return ercd;
+	if (!pk_rtsk) return E_PAR;
+	if (!taskinfo->isExist) pk_rtsk->tskstat = TTS_DMT;
+	else if (taskinfo->isWaiting) pk_rtsk->tskstat = TTS_WAI;
+	else if (taskContext && taskinfo == running_task) pk_rtsk->tskstat = TTS_RUN;
+	else pk_rtsk->tskstat = TTS_RDY;
+	pk_rtsk->tskpri = taskinfo->priority;
+	pk_rtsk->tskbpri = taskinfo->basePriority;
+	pk_rtsk->tskwait = taskinfo->isWaiting ? taskinfo->waitReason : 0;
+	pk_rtsk->wupcnt = taskinfo->wakeupCount;
+	pk_rtsk->name = taskinfo->taskName;
+
+	const TaskStats& stats = taskinfo->stats;
+	pk_rtsk->dspcnt = stats.dispatchCount;
+	pk_rtsk->runtim = stats.runTime;
+	for (int i = 0; i < TNUM_TSTAT_WAIT; i++) pk_rtsk->waittim[i] = stats.waitTime[i];
+	for (int i = 0; i < TNUM_TSTAT_LATENCY; i++) pk_rtsk->latency[i] = stats.latency[i];
+	pk_rtsk->stksz = taskinfo->stackSize;
+	pk_rtsk->stkused = static_cast<UINT>(PortStackUsed(&taskinfo->context));
+	return E_OK;
+}
+
+ER GetTime(SYSTIM* p_systim) {
+	if (!p_systim) return E_PAR;
+	*p_systim = systemTick;
+	return E_OK;
 }
 
 // イベントフラグ情報構造体
 struct FlagInfo {
+	ID flgid;
+	ATR flgatr;				// TA_WSGL / TA_WMUL、TA_CLR
 	FLGPTN flgptn;
 	const char* name;
-	std::queue<std::shared_ptr<TaskInfo>> waitQueue;
+	Queue waitQueue;		// TaskInfo::node をつなぐ
+	UINT waitCount;			// 待ち状態に入ったタスクの延べ数
 };
 
 static ContextManager<FlagInfo, ID_FLAG_MAX> flagManager;
 
-void CreteFlag(ID flgid, const char* name, FLGPTN iflgptn) {
-	FlagInfo flagInfo;
-	flagInfo.name = name;
-	flagInfo.flgptn = iflgptn;
-	flagManager.registerContext(flgid, std::make_shared<FlagInfo>(flagInfo));
+static inline bool FlagConditionMet(FLGPTN flgptn, FLGPTN waiptn, MODE wfmode) {
+	if (wfmode == TWF_ANDW) return (flgptn & waiptn) == waiptn;
+	return (flgptn & waiptn) != 0;
 }
 
-void iSetFlag(ID flgid, FLGPTN setptn) {
-
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
+ER CreteFlag(ID flgid, const char* name, ATR flgatr, FLGPTN iflgptn) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (flgatr & ~(TA_WMUL | TA_CLR)) return E_PAR;
+	FlagInfo* flagInfo;
+	ER ercd = flagManager.createContext(flgid, &flagInfo);
+	if (ercd != E_OK) return ercd;
+	flagInfo->flgid = flgid;
+	flagInfo->flgatr = flgatr;
+	flagInfo->name = name;
+	flagInfo->flgptn = iflgptn;
+	flagInfo->waitCount = 0;
+	QueueInit(&flagInfo->waitQueue);
+	return E_OK;
+}
 
-	std::shared_ptr<FlagInfo> flagInfo = flagManager.getContext(flgid);
+static void FlagSet(FlagInfo* flagInfo, FLGPTN setptn) {
 	FLGPTN currentFlags = (flagInfo->flgptn |= setptn); // フラグの設定
 
-	debug_printf("Set Flag 1 acquired flag: %d\n", currentFlags);
-
-	if (!flagInfo->waitQueue.empty()) {
-		std::shared_ptr<TaskInfo> task = flagInfo->waitQueue.front();
-		flagInfo->waitQueue.pop();
-		if (task->isExist && task->isWaiting) {
-			bool conditionMet = false;
-			if (task->waitmode == TWF_ANDW) {
-				conditionMet = ((currentFlags & task->waitptn) == task->waitptn);
-			}
-			else if (task->waitmode == TWF_ORW) {
-				conditionMet = ((currentFlags & task->waitptn) != 0);
-			}
-			if (conditionMet) {
-				debug_printf("Resume Flag 1 task: %s\n", task->taskName);
-				task->isWaiting = false;
-				readyQueue.push(task); // 再度レディーキューに追加
-				task->waitptn = currentFlags;	// 本当は使い回しは良くないが、待ちパターンに解除パターンを入れて戻す
-				// break;
-			}
+	KLOG_DEBUG(KLOG_CAT_FLAG, "Set Flag 1 acquired flag: %d\n", currentFlags);
+	TRACE(TRACE_FLAG_SET, flagInfo->flgid, CurrentSource(), 0, currentFlags);
+
+	// 待ちキューを一度だけ先頭から調べ、条件を満たしたタスクをすべて解除する
+	// （どのタスクも同じパターンで判定し、TA_CLR のクリアは最後に一度だけ行う）
+	bool released = false;
+	Queue* entry = flagInfo->waitQueue.next;
+	while (entry != &flagInfo->waitQueue) {
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(entry);
+		entry = entry->next;	// 解除するとつながりが切れるので先に進めておく
+		if (FlagConditionMet(currentFlags, task->waitptn, task->waitmode)) {
+			KLOG_DEBUG(KLOG_CAT_FLAG, "Resume Flag 1 task: %s\n", task->taskName);
+			task->waitptn = currentFlags;	// 本当は使い回しは良くないが、待ちパターンに解除パターンを入れて戻す
+			ReleaseWait(task, E_OK); // 再度レディーキューに追加
+			released = true;
 		}
-		if (task->isWaiting) flagInfo->waitQueue.push(task);
 	}
+	if (released && (flagInfo->flgatr & TA_CLR)) flagInfo->flgptn = 0;
+}
 
-	/* <==== Critical */ LeaveCriticalSection(&criticalSection);
-
+ER iSetFlag(ID flgid, FLGPTN setptn) {
+	if (!flagManager.isValidId(flgid)) return E_ID;
+	return PostRequest(REQUEST_SET_FLAG, flgid, setptn, nullptr);
 }
 
-void SetFlag(ID flgid, FLGPTN setptn) {
-	iSetFlag(flgid, setptn);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+ER SetFlag(ID flgid, FLGPTN setptn) {
+	if (CallerDeleted()) return E_RLWAI;
+	FlagInfo* flagInfo;
+	ER ercd = flagManager.getContext(flgid, &flagInfo);
+	if (ercd != E_OK) return ercd;
+	FlagSet(flagInfo, setptn);
+	Reschedule();
+	return E_OK;
 }
 
-void ClearFlag(ID flgid, FLGPTN clearptn) {
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
-	std::shared_ptr<FlagInfo> flagInfo = flagManager.getContext(flgid);
+ER ClearFlag(ID flgid, FLGPTN clearptn) {
+	if (CallerDeleted()) return E_RLWAI;
+	FlagInfo* flagInfo;
+	ER ercd = flagManager.getContext(flgid, &flagInfo);
+	if (ercd != E_OK) return ercd;
 	flagInfo->flgptn &= clearptn; // フラグのクリア
-	/* <==== Critical */ LeaveCriticalSection(&criticalSection);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+	Reschedule();
+	return E_OK;
 }
 
-void WaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn) {
+// 条件を満たしていなければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER FlagWait(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn, TMO tmout) {
 
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
+	FlagInfo* flagInfo;
+	ER ercd = flagManager.getContext(flgid, &flagInfo);
+	if (ercd != E_OK) return ercd;
+	if (waiptn == 0 || (wfmode != TWF_ANDW && wfmode != TWF_ORW) || tmout < TMO_FEVR) return E_PAR;
+
+	// TA_WSGL のフラグを待てるのは一つのタスクだけ
+	if (!(flagInfo->flgatr & TA_WMUL) && !QueueEmpty(&flagInfo->waitQueue)) {
+		return E_ILUSE;
+	}
 
 	// すでにフラグが有効な場合の対処
-	std::shared_ptr<FlagInfo> flagInfo = flagManager.getContext(flgid);
 	FLGPTN currentFlags = flagInfo->flgptn;
-	bool conditionMet = false;
-	if (wfmode == TWF_ANDW) {
-		conditionMet = ((currentFlags & waiptn) == waiptn);
+	if (FlagConditionMet(currentFlags, waiptn, wfmode)) {
+		if (flagInfo->flgatr & TA_CLR) flagInfo->flgptn = 0;
+		if (p_flgptn) *p_flgptn = currentFlags;
 	}
-	else if (wfmode == TWF_ORW) {
-		conditionMet = ((currentFlags & waiptn) != 0);
+	else if (tmout == TMO_POL) {
+		return E_TMOUT;
 	}
-	if (conditionMet) {
-		/* <==== Critical */ LeaveCriticalSection(&criticalSection);
-		if (p_flgptn) *p_flgptn = currentFlags;
+	else if (!running_task->isExist) {
+		return E_RLWAI; // 終了したタスクは待たずに戻る
+	}
+	else if (dispatchDisabled || cpuLocked) {
+		return E_CTX; // 区間の中では待てない
 	}
 	else {
-		running_task->isWaiting = true; // 自タスクを待ち状態にする
 		running_task->waitptn = waiptn;
 		running_task->waitmode = wfmode;
-		flagInfo->waitQueue.push(running_task);
-		/* <==== Critical */ LeaveCriticalSection(&criticalSection);
-		if (running_task->isExist) TaskYield(); // 実行権を譲る
+		flagInfo->waitCount++;
+		WaitTaskTimeout(TTW_FLG, &flagInfo->waitQueue, tmout); // 自タスクを待ち状態にする
+		TaskYield(); // 実行権を譲る
+		if (running_task->wercd != E_OK) return running_task->wercd;
 		if (p_flgptn) *p_flgptn = running_task->waitptn;	// 解除パターンを受け取る
 	}
+	return E_OK;
+}
+
+ER WaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn) {
+	if (CallerDeleted()) return E_RLWAI;
+	return FlagWait(flgid, waiptn, wfmode, p_flgptn, TMO_FEVR);
+}
+
+ER pWaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn) {
+	if (CallerDeleted()) return E_RLWAI;
+	return FlagWait(flgid, waiptn, wfmode, p_flgptn, TMO_POL);
+}
+
+ER tWaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return FlagWait(flgid, waiptn, wfmode, p_flgptn, tmout);
 }
 
-void ReferenceFlg(ID flgid, T_RFLG *pk_rflg) {
-	std::shared_ptr<FlagInfo> flagInfo = flagManager.getContext(flgid);
+ER ReferenceFlg(ID flgid, T_RFLG *pk_rflg) {
+	FlagInfo* flagInfo;
+	ER ercd = flagManager.getContext(flgid, &flagInfo);
+	if (ercd != E_OK) return ercd;
 	if (pk_rflg) {
+		pk_rflg->wtskid = QueueEmpty(&flagInfo->waitQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(flagInfo->waitQueue.next)->tskid;
 		pk_rflg->flgptn = flagInfo->flgptn;
+		pk_rflg->name = flagInfo->name;
+		pk_rflg->waicnt = flagInfo->waitCount;
 	}
+	return E_OK;
 }
 
 // データキュー情報構造体
+// データは長さを 2 のべき乗に切り上げたリングバッファに入れ、容量（dtqcnt）を超える送信は待たせる
+// 容量 0 のデータキューはバッファを持たず、送信タスクと受信タスクが直接受け渡す
 struct DtqInfo {
-	std::queue<VP_INT> dataQueue;
+	ID dtqid;
+	VP_INT* buffer;
+	bool ownsBuffer;		// buffer をカーネルが確保した
+	UINT mask;				// バッファ長 - 1
+	UINT capacity;
+	UINT head;				// 次に受け取るデータの位置
+	UINT count;				// 貯まっているデータの数
+	UINT maxCount;			// count の最大値
 	const char* name;
-	std::queue<std::shared_ptr<TaskInfo>> waitQueue;
+	Queue sendQueue;		// 送信待ちの TaskInfo::node をつなぐ
+	Queue receiveQueue;		// 受信待ちの TaskInfo::node をつなぐ
 };
 
 static ContextManager<DtqInfo, ID_DTQ_MAX> dataQueueManager;
 
-void CreateDataQueue(ID dtqid, const char* name) {
-	DtqInfo dtqInfo;
-	dtqInfo.name = name;
-	dataQueueManager.registerContext(dtqid, std::make_shared<DtqInfo>(dtqInfo));
+static inline void DtqPush(DtqInfo* dtqInfo, VP_INT data) {
+	dtqInfo->buffer[(dtqInfo->head + dtqInfo->count++) & dtqInfo->mask] = data;
+	if (dtqInfo->count > dtqInfo->maxCount) dtqInfo->maxCount = dtqInfo->count;
 }
 
-void iSendDataQueue(ID dtqid, VP_INT data) {
+static inline VP_INT DtqPop(DtqInfo* dtqInfo) {
+	VP_INT data = dtqInfo->buffer[dtqInfo->head];
+	dtqInfo->head = (dtqInfo->head + 1) & dtqInfo->mask;
+	dtqInfo->count--;
+	return data;
+}
 
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
+// 受信待ちタスクがあれば直接渡し、無ければ空きがある場合だけバッファに入れる
+static bool DtqSend(DtqInfo* dtqInfo, VP_INT data) {
+	if (QueueEmpty(&dtqInfo->receiveQueue) && dtqInfo->count >= dtqInfo->capacity) return false;
+	TRACE(TRACE_DTQ_SEND, dtqInfo->dtqid, CurrentSource(), 0, static_cast<UINT>(reinterpret_cast<uintptr_t>(data)));
+	if (!QueueEmpty(&dtqInfo->receiveQueue)) {
+		// 受信待ちがあるのはバッファが空のときだけなので、追い越しにはならない
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(dtqInfo->receiveQueue.next);
+		KLOG_DEBUG(KLOG_CAT_DTQ, "Send DataQueue task: %s\n", task->taskName);
+		task->receptData = data;
+		ReleaseWait(task, E_OK); // 再度レディーキューに追加
+		return true;
+	}
+	DtqPush(dtqInfo, data);
+	return true;
+}
 
-	std::shared_ptr<DtqInfo> dtqInfo = dataQueueManager.getContext(dtqid);
+ER CreateDataQueue(ID dtqid, const char* name, UINT dtqcnt, VP_INT* dtq) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (dtqcnt > 0x80000000u) return E_PAR;	// 2 のべき乗に切り上げられない
+	if (dtq && (dtqcnt & (dtqcnt - 1))) return E_PAR;
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.createContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+
+	UINT size = 0;
+	dtqInfo->buffer = nullptr;
+	dtqInfo->ownsBuffer = false;
+	if (dtqcnt && dtq) {
+		size = dtqcnt;
+		dtqInfo->buffer = dtq;
+	}
+	else if (dtqcnt) {
+		for (size = 1; size < dtqcnt; size <<= 1);
+		dtqInfo->ownsBuffer = true;
+		dtqInfo->buffer = static_cast<VP_INT*>(malloc(sizeof(VP_INT) * size));
+		if (dtqInfo->buffer == nullptr) {
+			KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to allocate %s\n", name);
+			dataQueueManager.deleteContext(dtqid);
+			return E_NOMEM;
+		}
+	}
+	dtqInfo->mask = size ? size - 1 : 0;
+	dtqInfo->dtqid = dtqid;
+	dtqInfo->capacity = dtqcnt;
+	dtqInfo->head = 0;
+	dtqInfo->count = 0;
+	dtqInfo->maxCount = 0;
+	dtqInfo->name = name;
+	QueueInit(&dtqInfo->sendQueue);
+	QueueInit(&dtqInfo->receiveQueue);
+	return E_OK;
+}
 
-	dtqInfo->dataQueue.push(data);
+// 待たずに送る（満杯なら送らずに E_TMOUT）
+static ER DtqTrySend(DtqInfo* dtqInfo, VP_INT data) {
+	KLOG_DEBUG(KLOG_CAT_DTQ, "Send DataQueue data: %d\n", (int)(intptr_t)data);
+	if (!DtqSend(dtqInfo, data)) {
+		KLOG_WARN(KLOG_CAT_DTQ, "%s is full\n", dtqInfo->name);
+		return E_TMOUT;
+	}
+	return E_OK;
+}
 
-	debug_printf("Send DataQueue data: %d\n", data);
+// 満杯で送れなかったことはディスパッチャーが要求を処理するときにしか分からない
+ER iSendDataQueue(ID dtqid, VP_INT data) {
+	if (!dataQueueManager.isValidId(dtqid)) return E_ID;
+	return PostRequest(REQUEST_SEND_DATA_QUEUE, dtqid, 0, data);
+}
 
-	if (!dtqInfo->waitQueue.empty()) {
-		std::shared_ptr<TaskInfo> task = dtqInfo->waitQueue.front();
-		dtqInfo->waitQueue.pop();
-		if (task->isExist && task->isWaiting) {
-			debug_printf("Send DataQueue task: %s\n", task->taskName);
-			task->receptData = dtqInfo->dataQueue.front();
-			dtqInfo->dataQueue.pop();
-			task->isWaiting = false;
-			readyQueue.push(task); // 再度レディーキューに追加
-		}
-		if (task->isWaiting) dtqInfo->waitQueue.push(task);
-	}
+ER pSendDataQueue(ID dtqid, VP_INT data) {
+	if (CallerDeleted()) return E_RLWAI;
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+	ercd = DtqTrySend(dtqInfo, data);
+	if (ercd != E_OK) return ercd;
+	Reschedule();
+	return E_OK;
+}
 
-	/* <==== Critical */ LeaveCriticalSection(&criticalSection);
+// 満杯なら tmout（TMO_POL は使わない、pSendDataQueue を参照）に従って待つ
+static ER DtqSendWait(ID dtqid, VP_INT data, TMO tmout) {
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+	if (tmout < TMO_FEVR) return E_PAR;
 
+	KLOG_DEBUG(KLOG_CAT_DTQ, "Send DataQueue data: %d\n", (int)(intptr_t)data);
+
+	if (DtqSend(dtqInfo, data)) {
+		Reschedule();
+		return E_OK;
+	}
+	if (!running_task->isExist) {
+		return E_RLWAI; // 終了したタスクは待たずに戻る
+	}
+	if (dispatchDisabled || cpuLocked) {
+		return E_CTX; // 区間の中では待てない
+	}
+	// 満杯（容量 0 なら受信タスクが来るまで）なので、受信側が取り出すのを待つ
+	running_task->sendData = data;
+	WaitTaskTimeout(TTW_SDTQ, &dtqInfo->sendQueue, tmout); // 自タスクを待ち状態にする
+	TaskYield(); // 実行権を譲る
+	return running_task->wercd;
+}
+
+ER SendDataQueue(ID dtqid, VP_INT data) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqSendWait(dtqid, data, TMO_FEVR);
 }
 
-void pSendDataQueue(ID dtqid, VP_INT data) {
-	iSendDataQueue(dtqid, data);
-	if (running_task->isExist) TaskYield(); // 実行権を譲る
+ER tSendDataQueue(ID dtqid, VP_INT data, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (tmout == TMO_POL) return pSendDataQueue(dtqid, data);
+	return DtqSendWait(dtqid, data, tmout);
 }
 
-void ReceiveDataQueue(ID dtqid, VP_INT *p_data) {
-	/* Critical ====> */ EnterCriticalSection(&criticalSection);
-	std::shared_ptr<DtqInfo> dtqInfo = dataQueueManager.getContext(dtqid);
+// 待たずに受け取る（データも送信待ちタスクも無ければ false）
+static bool DtqTryReceive(DtqInfo* dtqInfo, VP_INT *p_data) {
 	// すでにキューにデータが貯まっている場合の対処
-	if (!dtqInfo->dataQueue.empty()) {
-		*p_data = dtqInfo->dataQueue.front();
-		dtqInfo->dataQueue.pop();
-		/* <==== Critical */ LeaveCriticalSection(&criticalSection);
+	if (dtqInfo->count) {
+		*p_data = DtqPop(dtqInfo);
+		// 空いた分に送信待ちタスクのデータを入れる
+		if (!QueueEmpty(&dtqInfo->sendQueue)) {
+			TaskInfo* task = reinterpret_cast<TaskInfo*>(dtqInfo->sendQueue.next);
+			DtqPush(dtqInfo, task->sendData);
+			ReleaseWait(task, E_OK);
+		}
+		return true;
+	}
+	if (!QueueEmpty(&dtqInfo->sendQueue)) {
+		// 容量 0 のデータキューでは、送信待ちタスクから直接受け取る
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(dtqInfo->sendQueue.next);
+		*p_data = task->sendData;
+		ReleaseWait(task, E_OK);
+		return true;
+	}
+	return false;
 }
-	else {
-		running_task->isWaiting = true; // 自タスクを待ち状態にする
-		dtqInfo->waitQueue.push(running_task);
-		/* <==== Critical */ LeaveCriticalSection(&criticalSection);
-		if (running_task->isExist) TaskYield(); // 実行権を譲る
+
+// データが無ければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER DtqReceive(ID dtqid, VP_INT *p_data, TMO tmout) {
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+	if (!p_data || tmout < TMO_FEVR) return E_PAR;
+	if (!DtqTryReceive(dtqInfo, p_data)) {
+		if (tmout == TMO_POL) return E_TMOUT;
+		if (!running_task->isExist) return E_RLWAI; // 終了したタスクは待たずに戻る
+		if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+		WaitTaskTimeout(TTW_RDTQ, &dtqInfo->receiveQueue, tmout); // 自タスクを待ち状態にする
+		TaskYield(); // 実行権を譲る
+		if (running_task->wercd != E_OK) return running_task->wercd;
 		*p_data = running_task->receptData;	// キューからデータを受け取る
 	}
+	TRACE(TRACE_DTQ_RECEIVE, dtqid, CurrentSource(), 0, static_cast<UINT>(reinterpret_cast<uintptr_t>(*p_data)));
+	return E_OK;
+}
+
+ER ReceiveDataQueue(ID dtqid, VP_INT *p_data) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceive(dtqid, p_data, TMO_FEVR);
 }
 
-void ReferenceDataQueue(ID dtqid, T_RDTQ *pk_rdtq) {
-	std::shared_ptr<DtqInfo> dtqInfo = dataQueueManager.getContext(dtqid);
+ER pReceiveDataQueue(ID dtqid, VP_INT *p_data) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceive(dtqid, p_data, TMO_POL);
+}
+
+ER tReceiveDataQueue(ID dtqid, VP_INT *p_data, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceive(dtqid, p_data, tmout);
+}
+
+ER ReferenceDataQueue(ID dtqid, T_RDTQ *pk_rdtq) {
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
 	if (pk_rdtq) {
-		pk_rdtq->sdtqcnt = dtqInfo->dataQueue.size();
+		pk_rdtq->stskid = QueueEmpty(&dtqInfo->sendQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(dtqInfo->sendQueue.next)->tskid;
+		pk_rdtq->rtskid = QueueEmpty(&dtqInfo->receiveQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(dtqInfo->receiveQueue.next)->tskid;
+		pk_rdtq->sdtqcnt = dtqInfo->count;
+		pk_rdtq->name = dtqInfo->name;
+		pk_rdtq->sdtqmax = dtqInfo->maxCount;
 	}
+	return E_OK;
 }
 
 // ------------------------------------------
+// データキューのまとめ送受信
+//   一つずつ送受信するのと同じ順序と受け渡しで、呼び出しと実行権の譲渡を一回にまとめる
+//   待つ場合は一つずつ待ち、解除されたら続きをまとめて処理する（tmout は呼び出し全体の期限）
 
-int startupTinyOS() {
+#define DTQ_BATCH_MAX	0x7FFFFFFFu		// 戻り値（ER_UINT）で返せる数
 
-	debug_printf("------- SYSTEM START -------\n");
+// 期限までの残りティック数（TMO_FEVR はそのまま、期限を過ぎていれば TMO_POL）
+static TMO TimeoutLeft(TMO tmout, SYSTIM deadline) {
+	if (tmout == TMO_FEVR) return TMO_FEVR;
+	return (deadline > systemTick) ? static_cast<TMO>(deadline - systemTick) : TMO_POL;
+}
 
-	InitializeCriticalSection(&criticalSection);
+static ER_UINT DtqSendBatch(ID dtqid, const VP_INT *data, UINT cnt, TMO tmout) {
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+	if (!data || cnt == 0 || cnt > DTQ_BATCH_MAX || tmout < TMO_FEVR) return E_PAR;
+	SYSTIM deadline = systemTick + ((tmout > 0) ? tmout : 0);
+	UINT sent = 0;
+	while (sent < cnt) {
+		if (DtqSend(dtqInfo, data[sent])) {
+			sent++;
+			continue;
+		}
+		// 満杯になったので、残りの先頭のデータを持って空くまで待つ
+		TMO left = TimeoutLeft(tmout, deadline);
+		if (left == TMO_POL) {
+			ercd = E_TMOUT;
+			break;
+		}
+		if (!running_task->isExist) {
+			ercd = E_RLWAI; // 終了したタスクは待たずに戻る
+			break;
+		}
+		if (dispatchDisabled || cpuLocked) {
+			ercd = E_CTX; // 区間の中では待てない
+			break;
+		}
+		running_task->sendData = data[sent];
+		WaitTaskTimeout(TTW_SDTQ, &dtqInfo->sendQueue, left); // 自タスクを待ち状態にする
+		TaskYield(); // 実行権を譲る
+		ercd = running_task->wercd;
+		if (ercd != E_OK) break;
+		sent++;
+	}
+	Reschedule();
+	return sent ? static_cast<ER_UINT>(sent) : ercd;
+}
 
-	configTinyOS();
+ER_UINT SendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqSendBatch(dtqid, data, cnt, TMO_FEVR);
+}
 
-	// スケジューラーを開始
-	yieldEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-	if (yieldEvent == nullptr) {
-		debug_printf("Failed to setup TinyOS.\n");
-		return -1;
+ER_UINT pSendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqSendBatch(dtqid, data, cnt, TMO_POL);
+}
+
+ER_UINT tSendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqSendBatch(dtqid, data, cnt, tmout);
+}
+
+static ER_UINT DtqReceiveBatch(ID dtqid, VP_INT *p_data, UINT maxcnt, UINT mincnt, TMO tmout) {
+	DtqInfo* dtqInfo;
+	ER ercd = dataQueueManager.getContext(dtqid, &dtqInfo);
+	if (ercd != E_OK) return ercd;
+	if (!p_data || maxcnt == 0 || maxcnt > DTQ_BATCH_MAX || mincnt > maxcnt || tmout < TMO_FEVR) return E_PAR;
+	SYSTIM deadline = systemTick + ((tmout > 0) ? tmout : 0);
+	UINT received = 0;
+	while (received < maxcnt) {
+		if (DtqTryReceive(dtqInfo, &p_data[received])) {
+			received++;
+			continue;
+		}
+		if (received >= mincnt) break;
+		// 足りない分の一つ目が届くまで待つ
+		TMO left = TimeoutLeft(tmout, deadline);
+		if (left == TMO_POL) {
+			ercd = E_TMOUT;
+			break;
+		}
+		if (!running_task->isExist) {
+			ercd = E_RLWAI; // 終了したタスクは待たずに戻る
+			break;
+		}
+		if (dispatchDisabled || cpuLocked) {
+			ercd = E_CTX; // 区間の中では待てない
+			break;
+		}
+		WaitTaskTimeout(TTW_RDTQ, &dtqInfo->receiveQueue, left); // 自タスクを待ち状態にする
+		TaskYield(); // 実行権を譲る
+		ercd = running_task->wercd;
+		if (ercd != E_OK) break;
+		p_data[received++] = running_task->receptData;	// キューからデータを受け取る
 	}
-	SetEvent(yieldEvent);
-	return 0;
+	for (UINT i = 0; i < received; i++) {
+		TRACE(TRACE_DTQ_RECEIVE, dtqid, CurrentSource(), 0, static_cast<UINT>(reinterpret_cast<uintptr_t>(p_data[i])));
+	}
+	return received ? static_cast<ER_UINT>(received) : ercd;
 }
 
-int stopRequestTinyOS() {
-	for (auto& task : tasks) {
-		DeleteTask(task);
-		SetEvent(task->excuteEvent); // Wake up the task to let it exit
+ER_UINT ReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt, UINT mincnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceiveBatch(dtqid, p_data, maxcnt, mincnt, TMO_FEVR);
+}
+
+ER_UINT pReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceiveBatch(dtqid, p_data, maxcnt, 1, TMO_POL);
+}
+
+ER_UINT tReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt, UINT mincnt, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return DtqReceiveBatch(dtqid, p_data, maxcnt, mincnt, tmout);
+}
+
+// ------------------------------------------
+
+// セマフォ情報構造体
+struct SemInfo {
+	ID semid;
+	UINT count;				// 資源数
+	UINT maxCount;
+	const char* name;
+	Queue waitQueue;		// 獲得待ちの TaskInfo::node を到着順につなぐ
+};
+
+static ContextManager<SemInfo, ID_SEM_MAX> semaphoreManager;
+
+ER CreateSemaphore(ID semid, const char* name, UINT isemcnt, UINT maxsem) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (maxsem == 0 || isemcnt > maxsem) return E_PAR;
+	SemInfo* semInfo;
+	ER ercd = semaphoreManager.createContext(semid, &semInfo);
+	if (ercd != E_OK) return ercd;
+
+	semInfo->semid = semid;
+	semInfo->count = isemcnt;
+	semInfo->maxCount = maxsem;
+	semInfo->name = name;
+	QueueInit(&semInfo->waitQueue);
+	return E_OK;
+}
+
+// 待ちキューの先頭から、資源数が足りるタスクを順に解除する
+// （先頭が足りなければ、後ろのタスクが足りても追い越させずにそこで止める）
+static void SemServeWaiters(SemInfo* semInfo) {
+	while (!QueueEmpty(&semInfo->waitQueue)) {
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(semInfo->waitQueue.next);
+		if (semInfo->count < task->waitUnits) break;
+		semInfo->count -= task->waitUnits;
+		ReleaseWait(task, E_OK); // 再度レディーキューに追加
 	}
-	return 0;
 }
 
-int cleanupTinyOS() {
-	// クリーンアップ
-	for (auto& task : tasks) {
-		WaitForSingleObject(task->threadHandle, INFINITE);
-		CloseHandle(task->threadHandle);
-		CloseHandle(task->excuteEvent);
+// 待ちタスクに渡しきれずに残る資源数が上限を超えるなら、何もせずに E_QOVR
+static ER SemSignal(SemInfo* semInfo, UINT cnt) {
+	if (cnt == 0) return E_PAR;
+	// 解除されるタスクを先にたどって、残る資源数を求める
+	uint64_t remain = static_cast<uint64_t>(semInfo->count) + cnt;
+	Queue* stop = semInfo->waitQueue.next;
+	for (; stop != &semInfo->waitQueue; stop = stop->next) {
+		UINT units = reinterpret_cast<TaskInfo*>(stop)->waitUnits;
+		if (remain < units) break;
+		remain -= units;
 	}
-	CloseHandle(yieldEvent);
-	debug_printf("------- SYSTEM END -------\n");
-	return 0;
+	if (remain > semInfo->maxCount) return E_QOVR;
+	while (semInfo->waitQueue.next != stop) {
+		ReleaseWait(reinterpret_cast<TaskInfo*>(semInfo->waitQueue.next), E_OK); // 再度レディーキューに追加
+	}
+	semInfo->count = static_cast<UINT>(remain);
+	return E_OK;
 }
 
-enum {
-	WM_USER_TIMER = WM_USER + 1,
-	WM_USER_TIMER2,
+// 結果はディスパッチャーが要求を処理するときに決まる（ここで返すのは引数の検査と要求の受付まで）
+ER iSignalSemaphore(ID semid, UINT cnt) {
+	if (!semaphoreManager.isValidId(semid)) return E_ID;
+	if (cnt == 0) return E_PAR;
+	return PostRequest(REQUEST_SIGNAL_SEMAPHORE, semid, cnt, nullptr);
+}
+
+ER SignalSemaphore(ID semid, UINT cnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	SemInfo* semInfo;
+	ER ercd = semaphoreManager.getContext(semid, &semInfo);
+	if (ercd != E_OK) return ercd;
+	ercd = SemSignal(semInfo, cnt);
+	if (ercd != E_OK) return ercd;
+	Reschedule();
+	return E_OK;
+}
+
+// 足りなければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER SemWait(ID semid, UINT cnt, TMO tmout) {
+	SemInfo* semInfo;
+	ER ercd = semaphoreManager.getContext(semid, &semInfo);
+	if (ercd != E_OK) return ercd;
+	// 上限を超える要求は待っても満たせない
+	if (cnt == 0 || cnt > semInfo->maxCount || tmout < TMO_FEVR) return E_PAR;
+	// 待っているタスクがあれば、足りる場合でもその後ろに並ぶ
+	if (QueueEmpty(&semInfo->waitQueue) && semInfo->count >= cnt) {
+		semInfo->count -= cnt;
+		return E_OK;
+	}
+	if (tmout == TMO_POL) return E_TMOUT;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクは待たずに戻る
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+	running_task->waitUnits = cnt;
+	running_task->waitSemaphore = semInfo;
+	WaitTaskTimeout(TTW_SEM, &semInfo->waitQueue, tmout); // 自タスクを待ち状態にする
+	TaskYield(); // 実行権を譲る
+	return running_task->wercd;
+}
+
+ER WaitSemaphore(ID semid, UINT cnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return SemWait(semid, cnt, TMO_FEVR);
+}
+
+ER pWaitSemaphore(ID semid, UINT cnt) {
+	if (CallerDeleted()) return E_RLWAI;
+	return SemWait(semid, cnt, TMO_POL);
+}
+
+ER tWaitSemaphore(ID semid, UINT cnt, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return SemWait(semid, cnt, tmout);
+}
+
+ER ReferenceSemaphore(ID semid, T_RSEM *pk_rsem) {
+	SemInfo* semInfo;
+	ER ercd = semaphoreManager.getContext(semid, &semInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_rsem) {
+		pk_rsem->wtskid = QueueEmpty(&semInfo->waitQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(semInfo->waitQueue.next)->tskid;
+		pk_rsem->semcnt = semInfo->count;
+		pk_rsem->name = semInfo->name;
+		pk_rsem->semmax = semInfo->maxCount;
+	}
+	return E_OK;
+}
+
+// ------------------------------------------
+
+// 固定長メモリープール情報構造体
+// 空きブロックは先頭に次の空きブロックへのポインタを書いてつなぐ（取得・返却とも先頭で O(1)）
+struct MpfInfo {
+	ID mpfid;
+	char* area;
+	bool ownsArea;			// area をカーネルが確保した
+	UINT blockCount;
+	UINT blockSize;			// ポインタのサイズに切り上げたもの
+	void* freeList;
+	UINT freeCount;
+	UINT minFreeCount;		// freeCount の最小値
+	const char* name;
+	Queue waitQueue;		// 取得待ちの TaskInfo::node を到着順につなぐ
 };
 
-// ウィンドウプロシージャ
-LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
-    switch (msg) {
-	case WM_CREATE:
-		SetTimer(hWnd, WM_USER_TIMER, 500, nullptr); // タイマーイベントを設定
-		SetTimer(hWnd, WM_USER_TIMER2, 10000, nullptr); // タイマーイベントを設定
-		break;
-	case WM_CLOSE:
-		if (task_counter) {
-			stopRequestTinyOS();
+static ContextManager<MpfInfo, ID_MPF_MAX> fixedPoolManager;
+
+ER CreateFixedMemoryPool(ID mpfid, const char* name, UINT blkcnt, UINT blksz, VP mpf) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (blkcnt == 0 || blksz == 0) return E_PAR;
+	UINT size = (blksz + sizeof(void*) - 1) & ~static_cast<UINT>(sizeof(void*) - 1);
+	if (size < blksz || blkcnt > ~static_cast<UINT>(0) / size) return E_PAR;
+	if (reinterpret_cast<uintptr_t>(mpf) % sizeof(void*)) return E_PAR;
+	MpfInfo* mpfInfo;
+	ER ercd = fixedPoolManager.createContext(mpfid, &mpfInfo);
+	if (ercd != E_OK) return ercd;
+
+	mpfInfo->ownsArea = (mpf == nullptr);
+	mpfInfo->area = static_cast<char*>(mpf ? mpf : malloc(static_cast<size_t>(blkcnt) * size));
+	if (mpfInfo->area == nullptr) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to allocate %s\n", name);
+		fixedPoolManager.deleteContext(mpfid);
+		return E_NOMEM;
+	}
+	mpfInfo->mpfid = mpfid;
+	mpfInfo->blockCount = blkcnt;
+	mpfInfo->blockSize = size;
+	mpfInfo->name = name;
+	// 番地の小さいブロックから順に払い出すようにつなぐ
+	mpfInfo->freeList = nullptr;
+	for (UINT i = blkcnt; i-- > 0; ) {
+		void* block = mpfInfo->area + static_cast<size_t>(i) * size;
+		*static_cast<void**>(block) = mpfInfo->freeList;
+		mpfInfo->freeList = block;
+	}
+	mpfInfo->freeCount = blkcnt;
+	mpfInfo->minFreeCount = blkcnt;
+	QueueInit(&mpfInfo->waitQueue);
+	return E_OK;
+}
+
+static inline void* MpfTake(MpfInfo* mpfInfo) {
+	void* block = mpfInfo->freeList;
+	mpfInfo->freeList = *static_cast<void**>(block);
+	if (--mpfInfo->freeCount < mpfInfo->minFreeCount) mpfInfo->minFreeCount = mpfInfo->freeCount;
+	return block;
+}
+
+// 空きが無ければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER MpfGet(ID mpfid, VP* p_blk, TMO tmout) {
+	MpfInfo* mpfInfo;
+	ER ercd = fixedPoolManager.getContext(mpfid, &mpfInfo);
+	if (ercd != E_OK) return ercd;
+	if (!p_blk || tmout < TMO_FEVR) return E_PAR;
+	if (mpfInfo->freeList) {
+		*p_blk = MpfTake(mpfInfo);
+		return E_OK;
+	}
+	if (tmout == TMO_POL) return E_TMOUT;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクは待たずに戻る
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+	WaitTaskTimeout(TTW_MPF, &mpfInfo->waitQueue, tmout); // 自タスクを待ち状態にする
+	TaskYield(); // 実行権を譲る
+	if (running_task->wercd != E_OK) return running_task->wercd;
+	*p_blk = running_task->receptData;	// 返却されたブロックを受け取る
+	return E_OK;
+}
+
+ER GetFixedMemoryPool(ID mpfid, VP *p_blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MpfGet(mpfid, p_blk, TMO_FEVR);
+}
+
+ER pGetFixedMemoryPool(ID mpfid, VP *p_blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MpfGet(mpfid, p_blk, TMO_POL);
+}
+
+ER tGetFixedMemoryPool(ID mpfid, VP *p_blk, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MpfGet(mpfid, p_blk, tmout);
+}
+
+ER ReleaseFixedMemoryPool(ID mpfid, VP blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	MpfInfo* mpfInfo;
+	ER ercd = fixedPoolManager.getContext(mpfid, &mpfInfo);
+	if (ercd != E_OK) return ercd;
+	// プールのブロックの先頭でなければ受け付けない
+	char* block = static_cast<char*>(blk);
+	size_t offset = static_cast<size_t>(block - mpfInfo->area);
+	if (block < mpfInfo->area || offset >= static_cast<size_t>(mpfInfo->blockCount) * mpfInfo->blockSize
+		|| offset % mpfInfo->blockSize) {
+		return E_PAR;
+	}
+	if (!QueueEmpty(&mpfInfo->waitQueue)) {
+		// 待っているタスクがあれば、空きリストを通さずに先頭のタスクへ直接渡す
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(mpfInfo->waitQueue.next);
+		task->receptData = blk;
+		ReleaseWait(task, E_OK); // 再度レディーキューに追加
+	}
+	else {
+		*static_cast<void**>(blk) = mpfInfo->freeList;
+		mpfInfo->freeList = blk;
+		mpfInfo->freeCount++;
+	}
+	Reschedule();
+	return E_OK;
+}
+
+ER ReferenceFixedMemoryPool(ID mpfid, T_RMPF *pk_rmpf) {
+	MpfInfo* mpfInfo;
+	ER ercd = fixedPoolManager.getContext(mpfid, &mpfInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_rmpf) {
+		pk_rmpf->wtskid = QueueEmpty(&mpfInfo->waitQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(mpfInfo->waitQueue.next)->tskid;
+		pk_rmpf->fblkcnt = mpfInfo->freeCount;
+		pk_rmpf->name = mpfInfo->name;
+		pk_rmpf->fblkmin = mpfInfo->minFreeCount;
+	}
+	return E_OK;
+}
+
+// ------------------------------------------
+
+// 可変長メモリープール情報構造体
+struct MplInfo {
+	ID mplid;
+	char* area;
+	bool ownsArea;			// area をカーネルが確保した
+	Tlsf tlsf;
+	const char* name;
+	Queue waitQueue;		// 取得待ちの TaskInfo::node を到着順につなぐ
+};
+
+static ContextManager<MplInfo, ID_MPL_MAX> variablePoolManager;
+
+ER CreateVariableMemoryPool(ID mplid, const char* name, UINT mplsz, VP mpl) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (mplsz == 0 || reinterpret_cast<uintptr_t>(mpl) % sizeof(void*)) return E_PAR;
+	MplInfo* mplInfo;
+	ER ercd = variablePoolManager.createContext(mplid, &mplInfo);
+	if (ercd != E_OK) return ercd;
+
+	mplInfo->ownsArea = (mpl == nullptr);
+	mplInfo->area = static_cast<char*>(mpl ? mpl : malloc(mplsz));
+	if (mplInfo->area == nullptr) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to allocate %s\n", name);
+		variablePoolManager.deleteContext(mplid);
+		return E_NOMEM;
+	}
+	if (!TlsfInit(&mplInfo->tlsf, mplInfo->area, mplsz)) {
+		if (mplInfo->ownsArea) free(mplInfo->area);
+		variablePoolManager.deleteContext(mplid);
+		return E_PAR;	// 一つもブロックを作れない大きさ
+	}
+	mplInfo->mplid = mplid;
+	mplInfo->name = name;
+	QueueInit(&mplInfo->waitQueue);
+	return E_OK;
+}
+
+// 待ちキューの先頭から、要求を満たせるタスクを順に解除する
+// （先頭が満たせなければ、後ろのタスクが満たせても追い越させずにそこで止める）
+static void MplServeWaiters(MplInfo* mplInfo) {
+	while (!QueueEmpty(&mplInfo->waitQueue)) {
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(mplInfo->waitQueue.next);
+		void* block = TlsfAlloc(&mplInfo->tlsf, task->waitSize);
+		if (!block) break;
+		task->receptData = block;
+		ReleaseWait(task, E_OK); // 再度レディーキューに追加
+	}
+}
+
+// 足りなければ tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER MplGet(ID mplid, UINT blksz, VP* p_blk, TMO tmout) {
+	MplInfo* mplInfo;
+	ER ercd = variablePoolManager.getContext(mplid, &mplInfo);
+	if (ercd != E_OK) return ercd;
+	// プール全体でも足りない要求は待っても満たせない
+	if (!p_blk || blksz == 0 || blksz > mplInfo->tlsf.capacity || tmout < TMO_FEVR) return E_PAR;
+	// 待っているタスクがあれば、取れる場合でもその後ろに並ぶ
+	if (QueueEmpty(&mplInfo->waitQueue)) {
+		void* block = TlsfAlloc(&mplInfo->tlsf, blksz);
+		if (block) {
+			*p_blk = block;
+			return E_OK;
 		}
-		KillTimer(hWnd, WM_USER_TIMER); // タイマーイベントを破棄
-		cleanupTinyOS();
-		DestroyWindow(hWnd);
-		break;
-    case WM_DESTROY:
-        PostQuitMessage(0);
-        break;
-	case WM_TIMER:	// タイマーイベント
-		if (wParam == WM_USER_TIMER) {
-			StartDispatcher();
-		}
-		else if (wParam == WM_USER_TIMER2) {
-			static int count = 0;
-			// 非タスクからの呼び出しを想定
-			switch (count++) {
-			case 0:
-				debug_printf("ActionTask(ID_MMM)\n");
-				iWakeupTask(ID_TASK_MMM);
-				break;
-			case 1:
-				// wait
-				break;
-			case 2:
-				debug_printf("iSendDataQueue(ID_CCC, 765)\n");
-				iSendDataQueue(ID_DTQ_CCC, (VP_INT)765);
-				break;
-			case 3:
-				debug_printf("iSetFlag(ID_AAA, 0x01)\n");
-				iSetFlag(ID_FLAG_AAA, 0x01);
-				break;
-			case 4:
-				debug_printf("iSetFlag(ID_AAA, 0x02)\n");
-				iSetFlag(ID_FLAG_AAA, 0x02);
-				break;
-			default:
-				debug_printf("count = 0\n");
-				count = 0;
-				break;
-			}
+	}
+	if (tmout == TMO_POL) return E_TMOUT;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクは待たずに戻る
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+	running_task->waitSize = blksz;
+	running_task->waitPool = mplInfo;
+	WaitTaskTimeout(TTW_MPL, &mplInfo->waitQueue, tmout); // 自タスクを待ち状態にする
+	TaskYield(); // 実行権を譲る
+	if (running_task->wercd != E_OK) return running_task->wercd;
+	*p_blk = running_task->receptData;	// 確保されたブロックを受け取る
+	return E_OK;
+}
+
+ER GetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MplGet(mplid, blksz, p_blk, TMO_FEVR);
+}
+
+ER pGetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MplGet(mplid, blksz, p_blk, TMO_POL);
+}
+
+ER tGetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MplGet(mplid, blksz, p_blk, tmout);
+}
+
+ER ReleaseVariableMemoryPool(ID mplid, VP blk) {
+	if (CallerDeleted()) return E_RLWAI;
+	MplInfo* mplInfo;
+	ER ercd = variablePoolManager.getContext(mplid, &mplInfo);
+	if (ercd != E_OK) return ercd;
+	if (!TlsfFree(&mplInfo->tlsf, blk)) return E_PAR;
+	MplServeWaiters(mplInfo);
+	Reschedule();
+	return E_OK;
+}
+
+ER ReferenceVariableMemoryPool(ID mplid, T_RMPL *pk_rmpl) {
+	MplInfo* mplInfo;
+	ER ercd = variablePoolManager.getContext(mplid, &mplInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_rmpl) {
+		TlsfStats stats;
+		TlsfGetStats(&mplInfo->tlsf, &stats);
+		pk_rmpl->wtskid = QueueEmpty(&mplInfo->waitQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(mplInfo->waitQueue.next)->tskid;
+		pk_rmpl->fmplsz = static_cast<UINT>(stats.freeBytes);
+		pk_rmpl->fblksz = static_cast<UINT>(stats.allocatable);
+		pk_rmpl->name = mplInfo->name;
+		pk_rmpl->fblkcnt = static_cast<UINT>(stats.freeBlocks);
+		pk_rmpl->fmplmin = static_cast<UINT>(stats.minFreeBytes);
+		pk_rmpl->mplfrag = stats.freeBytes ? static_cast<UINT>(100 - stats.largestFree * 100 / stats.freeBytes) : 0;
+	}
+	return E_OK;
+}
+
+// ------------------------------------------
+
+// ミューテックス情報構造体
+struct MtxInfo {
+	Queue node;				// 所有タスクの heldMutexes につなぐ（先頭に置くこと）
+	ID mtxid;
+	ATR mtxatr;				// TA_TPRI / TA_INHERIT / TA_CEILING
+	PRI ceilpri;
+	TaskInfo* owner;		// ロックしているタスク（無ければ nullptr）
+	const char* name;
+	Queue waitQueue;		// TaskInfo::node を優先度順（同じ優先度は到着順）につなぐ
+};
+
+static ContextManager<MtxInfo, ID_MTX_MAX> mutexManager;
+
+// ベース優先度と、ロックしているミューテックスから決まる優先度
+static PRI EffectivePriority(TaskInfo* task) {
+	PRI priority = task->basePriority;
+	for (Queue* entry = task->heldMutexes.next; entry != &task->heldMutexes; entry = entry->next) {
+		MtxInfo* mtxInfo = reinterpret_cast<MtxInfo*>(entry);
+		PRI raised = priority;
+		if (mtxInfo->mtxatr == TA_CEILING) {
+			raised = mtxInfo->ceilpri;
+		}
+		else if (mtxInfo->mtxatr == TA_INHERIT && !QueueEmpty(&mtxInfo->waitQueue)) {
+			raised = reinterpret_cast<TaskInfo*>(mtxInfo->waitQueue.next)->priority;	// 先頭が最高優先度
 		}
+		if (raised < priority) priority = raised;
+	}
+	return priority;
+}
+
+// 優先度順の位置に入れる（同じ優先度の中では末尾）
+static void MtxQueueInsert(MtxInfo* mtxInfo, TaskInfo* task) {
+	Queue* entry = mtxInfo->waitQueue.next;
+	while (entry != &mtxInfo->waitQueue && reinterpret_cast<TaskInfo*>(entry)->priority <= task->priority) {
+		entry = entry->next;
+	}
+	QueueInsert(entry, &task->node);
+}
+
+// 現在優先度を変え、つながっているキューの中の位置を直す
+static void SetTaskPriority(TaskInfo* task, PRI priority) {
+	if (!task->isExist || task->isWaiting || (taskContext && task == running_task)) {
+		// 実行中のタスクはディスパッチャーに戻ったときに新しい優先度でレディーキューに入る
+		task->priority = priority;
+		if (task->isExist && task->isWaiting && task->waitReason == TTW_MTX) {
+			QueueDelete(&task->node);
+			MtxQueueInsert(task->waitMutex, task);
+		}
+	}
+	else {
+		UnreadyTask(task);
+		task->priority = priority;
+		ReadyTask(task);
+	}
+}
+
+// 優先度を決め直し、ミューテックス待ちの連鎖をたどって所有タスクにも伝える
+static void UpdateTaskPriority(TaskInfo* task) {
+	while (task) {
+		PRI priority = EffectivePriority(task);
+		if (priority == task->priority) return;
+		SetTaskPriority(task, priority);
+		if (!(task->isExist && task->isWaiting && task->waitReason == TTW_MTX)) return;
+		task = task->waitMutex->owner;
+	}
+}
+
+static void MtxAcquire(MtxInfo* mtxInfo, TaskInfo* task) {
+	mtxInfo->owner = task;
+	QueueInsert(&task->heldMutexes, &mtxInfo->node);
+	UpdateTaskPriority(task);
+}
+
+// ロックを解き、待ちタスクがあれば先頭（最高優先度）に渡す
+static void MtxRelease(MtxInfo* mtxInfo) {
+	TaskInfo* owner = mtxInfo->owner;
+	QueueDelete(&mtxInfo->node);
+	mtxInfo->owner = nullptr;
+	if (!QueueEmpty(&mtxInfo->waitQueue)) {
+		TaskInfo* task = reinterpret_cast<TaskInfo*>(mtxInfo->waitQueue.next);
+		ReleaseWait(task, E_OK); // 再度レディーキューに追加
+		MtxAcquire(mtxInfo, task);
+	}
+	UpdateTaskPriority(owner);	// 引き上げていた優先度を戻す
+}
+
+// 終了したタスクがロックしていたミューテックスをすべて解く
+static void MtxReleaseAll(TaskInfo* task) {
+	while (!QueueEmpty(&task->heldMutexes)) {
+		MtxRelease(reinterpret_cast<MtxInfo*>(task->heldMutexes.next));
+	}
+}
+
+ER CreateMutex(ID mtxid, const char* name, ATR mtxatr, PRI ceilpri) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (mtxatr != TA_TPRI && mtxatr != TA_INHERIT && mtxatr != TA_CEILING) return E_PAR;
+	if (mtxatr == TA_CEILING && (ceilpri < TMIN_TPRI || ceilpri > TMAX_TPRI)) return E_PAR;
+	MtxInfo* mtxInfo;
+	ER ercd = mutexManager.createContext(mtxid, &mtxInfo);
+	if (ercd != E_OK) return ercd;
+	mtxInfo->mtxid = mtxid;
+	mtxInfo->mtxatr = mtxatr;
+	mtxInfo->ceilpri = ceilpri;
+	mtxInfo->owner = nullptr;
+	mtxInfo->name = name;
+	QueueInit(&mtxInfo->node);
+	QueueInit(&mtxInfo->waitQueue);
+	return E_OK;
+}
+
+// ロックされていれば tmout に従って待つ（TMO_POL なら待たずに E_TMOUT）
+static ER MtxLock(ID mtxid, TMO tmout) {
+	MtxInfo* mtxInfo;
+	ER ercd = mutexManager.getContext(mtxid, &mtxInfo);
+	if (ercd != E_OK) return ercd;
+	if (!taskContext) return E_CTX;	// 所有者になるタスクがいない
+	if (tmout < TMO_FEVR) return E_PAR;
+	if (mtxInfo->owner == running_task) return E_ILUSE;	// 二重ロック
+	if (mtxInfo->mtxatr == TA_CEILING && running_task->basePriority < mtxInfo->ceilpri) return E_ILUSE;
+	if (!mtxInfo->owner) {
+		MtxAcquire(mtxInfo, running_task);
+		return E_OK;
+	}
+	if (tmout == TMO_POL) return E_TMOUT;
+	if (!running_task->isExist) return E_RLWAI; // 終了したタスクは待たずに戻る
+	if (dispatchDisabled || cpuLocked) return E_CTX; // 区間の中では待てない
+	running_task->waitMutex = mtxInfo;
+	WaitTaskTimeout(TTW_MTX, nullptr, tmout); // 自タスクを待ち状態にする
+	MtxQueueInsert(mtxInfo, running_task);
+	UpdateTaskPriority(mtxInfo->owner);	// 優先度継承
+	TaskYield(); // 実行権を譲る
+	return running_task->wercd;	// E_OK なら MtxRelease で所有が移っている
+}
+
+ER LockMutex(ID mtxid) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MtxLock(mtxid, TMO_FEVR);
+}
+
+ER pLockMutex(ID mtxid) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MtxLock(mtxid, TMO_POL);
+}
+
+ER tLockMutex(ID mtxid, TMO tmout) {
+	if (CallerDeleted()) return E_RLWAI;
+	return MtxLock(mtxid, tmout);
+}
+
+ER UnlockMutex(ID mtxid) {
+	if (CallerDeleted()) return E_RLWAI;
+	MtxInfo* mtxInfo;
+	ER ercd = mutexManager.getContext(mtxid, &mtxInfo);
+	if (ercd != E_OK) return ercd;
+	if (!taskContext) return E_CTX;
+	if (mtxInfo->owner != running_task) return E_ILUSE;
+	MtxRelease(mtxInfo);
+	Reschedule();
+	return E_OK;
+}
+
+ER ReferenceMutex(ID mtxid, T_RMTX *pk_rmtx) {
+	MtxInfo* mtxInfo;
+	ER ercd = mutexManager.getContext(mtxid, &mtxInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_rmtx) {
+		pk_rmtx->htskid = mtxInfo->owner ? mtxInfo->owner->tskid : TSK_NONE;
+		pk_rmtx->wtskid = QueueEmpty(&mtxInfo->waitQueue) ? TSK_NONE : reinterpret_cast<TaskInfo*>(mtxInfo->waitQueue.next)->tskid;
+		pk_rmtx->name = mtxInfo->name;
+	}
+	return E_OK;
+}
+
+// 待ち行列の先頭や優先度に効く待ちが、タイムアウトやタスクの終了で外れたときの後始末
+static void WaitCancelled(TaskInfo* task, UINT waitReason) {
+	switch (waitReason) {
+	case TTW_SEM:
+		SemServeWaiters(task->waitSemaphore);	// 先頭が外れると後ろのタスクの要求が満たせることがある
+		break;
+	case TTW_MPL:
+		MplServeWaiters(task->waitPool);	// 先頭が外れると後ろのタスクの要求が満たせることがある
 		break;
-    default:
-        return DefWindowProc(hWnd, msg, wParam, lParam);
-    }
-    return 0;
-}
-
-// エントリーポイント
-int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
-    // ウィンドウクラスの登録
-    WNDCLASS wc = {};
-    wc.lpfnWndProc = WndProc;
-    wc.hInstance = hInstance;
-    wc.lpszClassName = TEXT("TinyOSWindowClass");
-    RegisterClass(&wc);
-
-    // ウィンドウの作成
-    HWND hWnd = CreateWindowEx(
-        0,
-        wc.lpszClassName,
-        TEXT("TinyOS"),
-        WS_OVERLAPPEDWINDOW,
-        CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
-        NULL,
-        NULL,
-        hInstance,
-        NULL
-    );
-
-    if (hWnd == NULL) {
-        return 0;
-    }
-
-    ShowWindow(hWnd, nCmdShow);
-
-	if (startupTinyOS()) {
-		debug_printf("Failed to setup TinyOS.\n");
+	case TTW_MTX:
+		UpdateTaskPriority(task->waitMutex->owner);	// 継承していた優先度を戻す
+		break;
+	}
+}
+
+// ------------------------------------------
+// 周期ハンドラー・アラームハンドラー
+//   タイマーホイールにつなぎ、TimerTick から（ディスパッチャーのスレッドで、非タスクとして）呼ぶ
+
+// 満了するまでのティック数（満了時刻を過ぎていても次のティックで満了する）
+static RELTIM TimerLeft(const TimerEvent* event) {
+	return (event->expire > systemTick) ? static_cast<RELTIM>(event->expire - systemTick) : 1;
+}
+
+// 周期ハンドラー情報構造体
+struct CycInfo {
+	TimerEvent timer;		// expire は次の起動時刻（止まっている間も TA_PHS なら位相の基準として残す）
+	ID cycid;
+	ATR cycatr;
+	HandlerFunction handler;
+	VP_INT exinf;
+	RELTIM period;
+	bool isStarted;
+	UINT fireCount;
+	const char* name;
+};
+
+static ContextManager<CycInfo, ID_CYC_MAX> cyclicManager;
+
+static void CycFire(void* arg) {
+	CycInfo* cycInfo = static_cast<CycInfo*>(arg);
+	// 次の起動は今の満了時刻から数える（処理が遅れても位相がずれない）
+	// ハンドラーの中で止められるよう、呼ぶ前につなぎ直しておく
+	TimerStart(&cycInfo->timer, cycInfo->timer.expire + cycInfo->period);
+	cycInfo->fireCount++;
+	TRACE(TRACE_HANDLER_ENTER, cycInfo->cycid, TSK_NONE, TRACE_HANDLER_CYCLIC, 0);
+	cycInfo->handler(cycInfo->exinf);
+	TRACE(TRACE_HANDLER_EXIT, cycInfo->cycid, TSK_NONE, TRACE_HANDLER_CYCLIC, 0);
+}
+
+ER CreateCyclicHandler(ID cycid, const char* name, ATR cycatr, HandlerFunction cychdr, VP_INT exinf, RELTIM cyctim, RELTIM cycphs) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!cychdr || cyctim == 0 || cycphs > cyctim || (cycatr & ~(TA_STA | TA_PHS))) return E_PAR;
+	CycInfo* cycInfo;
+	ER ercd = cyclicManager.createContext(cycid, &cycInfo);
+	if (ercd != E_OK) return ercd;
+
+	QueueInit(&cycInfo->timer.node);
+	cycInfo->timer.callback = CycFire;
+	cycInfo->timer.arg = cycInfo;
+	cycInfo->timer.expire = systemTick + cycphs;
+	cycInfo->cycid = cycid;
+	cycInfo->cycatr = cycatr;
+	cycInfo->handler = cychdr;
+	cycInfo->exinf = exinf;
+	cycInfo->period = cyctim;
+	cycInfo->isStarted = (cycatr & TA_STA) != 0;
+	cycInfo->fireCount = 0;
+	cycInfo->name = name;
+	if (cycInfo->isStarted) TimerInsert(&cycInfo->timer);
+	return E_OK;
+}
+
+ER StartCyclicHandler(ID cycid) {
+	if (CallerDeleted()) return E_RLWAI;
+	CycInfo* cycInfo;
+	ER ercd = cyclicManager.getContext(cycid, &cycInfo);
+	if (ercd != E_OK) return ercd;
+	if (cycInfo->cycatr & TA_PHS) {
+		if (cycInfo->isStarted) return E_OK;
+		// 止まっている間に過ぎた起動時刻を飛ばし、元の位相で次に来る時刻から再開する
+		SYSTIM expire = cycInfo->timer.expire;
+		if (expire <= systemTick) expire += ((systemTick - expire) / cycInfo->period + 1) * cycInfo->period;
+		TimerStart(&cycInfo->timer, expire);
+	}
+	else {
+		TimerStart(&cycInfo->timer, systemTick + cycInfo->period);
+	}
+	cycInfo->isStarted = true;
+	return E_OK;
+}
+
+ER StopCyclicHandler(ID cycid) {
+	if (CallerDeleted()) return E_RLWAI;
+	CycInfo* cycInfo;
+	ER ercd = cyclicManager.getContext(cycid, &cycInfo);
+	if (ercd != E_OK) return ercd;
+	TimerStop(&cycInfo->timer);
+	cycInfo->isStarted = false;
+	return E_OK;
+}
+
+ER ReferenceCyclicHandler(ID cycid, T_RCYC *pk_rcyc) {
+	CycInfo* cycInfo;
+	ER ercd = cyclicManager.getContext(cycid, &cycInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_rcyc) {
+		pk_rcyc->cycstat = cycInfo->isStarted ? TCYC_STA : TCYC_STP;
+		pk_rcyc->lefttim = cycInfo->isStarted ? TimerLeft(&cycInfo->timer) : 0;
+		pk_rcyc->name = cycInfo->name;
+		pk_rcyc->actcnt = cycInfo->fireCount;
+	}
+	return E_OK;
+}
+
+// アラームハンドラー情報構造体
+struct AlmInfo {
+	TimerEvent timer;
+	ID almid;
+	HandlerFunction handler;
+	VP_INT exinf;
+	bool isStarted;
+	UINT fireCount;
+	const char* name;
+};
+
+static ContextManager<AlmInfo, ID_ALM_MAX> alarmManager;
+
+static void AlmFire(void* arg) {
+	AlmInfo* almInfo = static_cast<AlmInfo*>(arg);
+	almInfo->isStarted = false;	// ハンドラーの中で StartAlarmHandler を呼べば、もう一度起動する
+	almInfo->fireCount++;
+	TRACE(TRACE_HANDLER_ENTER, almInfo->almid, TSK_NONE, TRACE_HANDLER_ALARM, 0);
+	almInfo->handler(almInfo->exinf);
+	TRACE(TRACE_HANDLER_EXIT, almInfo->almid, TSK_NONE, TRACE_HANDLER_ALARM, 0);
+}
+
+ER CreateAlarmHandler(ID almid, const char* name, HandlerFunction almhdr, VP_INT exinf) {
+	if (CallerDeleted()) return E_RLWAI;
+	if (!almhdr) return E_PAR;
+	AlmInfo* almInfo;
+	ER ercd = alarmManager.createContext(almid, &almInfo);
+	if (ercd != E_OK) return ercd;
+
+	QueueInit(&almInfo->timer.node);
+	almInfo->timer.callback = AlmFire;
+	almInfo->timer.arg = almInfo;
+	almInfo->almid = almid;
+	almInfo->handler = almhdr;
+	almInfo->exinf = exinf;
+	almInfo->isStarted = false;
+	almInfo->fireCount = 0;
+	almInfo->name = name;
+	return E_OK;
+}
+
+ER StartAlarmHandler(ID almid, RELTIM almtim) {
+	if (CallerDeleted()) return E_RLWAI;
+	AlmInfo* almInfo;
+	ER ercd = alarmManager.getContext(almid, &almInfo);
+	if (ercd != E_OK) return ercd;
+	TimerStart(&almInfo->timer, systemTick + almtim);	// 0 なら次のティック
+	almInfo->isStarted = true;
+	return E_OK;
+}
+
+ER StopAlarmHandler(ID almid) {
+	if (CallerDeleted()) return E_RLWAI;
+	AlmInfo* almInfo;
+	ER ercd = alarmManager.getContext(almid, &almInfo);
+	if (ercd != E_OK) return ercd;
+	TimerStop(&almInfo->timer);
+	almInfo->isStarted = false;
+	return E_OK;
+}
+
+ER ReferenceAlarmHandler(ID almid, T_RALM *pk_ralm) {
+	AlmInfo* almInfo;
+	ER ercd = alarmManager.getContext(almid, &almInfo);
+	if (ercd != E_OK) return ercd;
+	if (pk_ralm) {
+		pk_ralm->almstat = almInfo->isStarted ? TALM_STA : TALM_STP;
+		pk_ralm->lefttim = almInfo->isStarted ? TimerLeft(&almInfo->timer) : 0;
+		pk_ralm->name = almInfo->name;
+		pk_ralm->actcnt = almInfo->fireCount;
+	}
+	return E_OK;
+}
+
+// ------------------------------------------
+
+// 非タスクからの要求を届いた順に処理する
+static void DrainRequests() {
+	ServiceRequest request;
+	while (requestQueue.pop(&request)) {
+		ER ercd = E_OK;
+		switch (request.code) {
+		case REQUEST_WAKEUP_TASK: {
+			TaskInfo* taskinfo;
+			ercd = task_manager.getContext(request.id, &taskinfo);
+			if (ercd == E_OK) ercd = TaskWakeup(taskinfo);
+			break;
+		}
+		case REQUEST_SET_FLAG: {
+			FlagInfo* flagInfo;
+			ercd = flagManager.getContext(request.id, &flagInfo);
+			if (ercd == E_OK) FlagSet(flagInfo, request.ptn);
+			break;
+		}
+		case REQUEST_SEND_DATA_QUEUE: {
+			DtqInfo* dtqInfo;
+			ercd = dataQueueManager.getContext(request.id, &dtqInfo);
+			if (ercd == E_OK) ercd = DtqTrySend(dtqInfo, request.data);
+			break;
+		}
+		case REQUEST_SIGNAL_SEMAPHORE: {
+			SemInfo* semInfo;
+			ercd = semaphoreManager.getContext(request.id, &semInfo);
+			if (ercd == E_OK) ercd = SemSignal(semInfo, request.ptn);
+			break;
+		}
+		}
+		if (ercd != E_OK) KLOG_WARN(KLOG_CAT_SYSTEM, "Deferred request %d for ID %d failed (%d)\n", request.code, request.id, ercd);
+	}
+}
+
+// ------------------------------------------
+
+int startupTinyOS() {
+
+	KLOG_INFO(KLOG_CAT_SYSTEM, "------- SYSTEM START -------\n");
+
+	for (Queue& queue : readyQueue) QueueInit(&queue);
+	TimerInitialize();
+
+	// スケジューラーを開始（呼び出し元スレッドがディスパッチャーになる）
+	if (!PortInitMainContext(&dispatcherContext)) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to setup TinyOS.\n");
 		return -1;
 	}
 
-    // メッセージループ
-    MSG msg = {};
-    while (GetMessage(&msg, NULL, 0, 0)) {
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
-    }
+	int ercd = configTinyOS();
+	if (ercd != 0) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "configTinyOS failed (%d).\n", ercd);
+		return -1;
+	}
+	return 0;
+}
+
+int stopRequestTinyOS() {
+	task_manager.forEach([](TaskInfo* task) {
+		DeleteTask(task);	// 各タスクは cleanupTinyOS で最後まで走らせて終了させる
+	});
+	return 0;
+}
 
-    return 0;
+int cleanupTinyOS() {
+	// クリーンアップ
+	task_manager.forEach([](TaskInfo* task) {
+		// 終了要求済みのタスクを再開し、タスク関数から抜けさせる
+		while (!task->isFinished) {
+			running_task = task;
+			taskContext = true;
+			PortSwitchContext(&dispatcherContext, &task->context);
+			taskContext = false;
+		}
+		PortDeleteContext(&task->context);
+	});
+	dataQueueManager.forEach([](DtqInfo* dtqInfo) {
+		if (dtqInfo->ownsBuffer) free(dtqInfo->buffer);
+		dtqInfo->buffer = nullptr;
+	});
+	fixedPoolManager.forEach([](MpfInfo* mpfInfo) {
+		if (mpfInfo->ownsArea) free(mpfInfo->area);
+		mpfInfo->area = nullptr;
+	});
+	variablePoolManager.forEach([](MplInfo* mplInfo) {
+		if (mplInfo->ownsArea) free(mplInfo->area);
+		mplInfo->area = nullptr;
+	});
+	PortExitMainContext(&dispatcherContext);
+	KLOG_INFO(KLOG_CAT_SYSTEM, "------- SYSTEM END -------\n");
+	flushLogTinyOS();
+	return 0;
 }
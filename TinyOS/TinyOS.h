@@ -4,10 +4,46 @@
 #include <string>
 #include <functional>
 
+#include "kernel.h"
+
 // ユーザータスクの定義はこの関数でユーザーが定義する
 int configTinyOS();
 
+// ホストから呼び出すカーネルのライフサイクル
+int startupTinyOS();
+int stopRequestTinyOS();
+int cleanupTinyOS();
+
+// スケジューラー（ディスパッチャー）、ホストのティックごとに呼ぶ
+void StartDispatcher();
+
+// ティックレス運用
+//   GetIdleTicks      : 次にティック処理が必要になるまでのティック数（1 以上）、
+//                       時間待ちが何も無ければ IDLE_FOREVER
+//   AdvanceDispatcher : 止まっていた ticks 分の時間をまとめて進めてからディスパッチする
+//   setWakeupHookTinyOS : 非タスクから i* の要求が積まれたときに呼ばれる（ホストを起こす）
+//                         i* を呼んだスレッドやシグナルハンドラーの上で呼ばれるので、async-signal-safe にすること
+#define IDLE_FOREVER	(~(SYSTIM)0)
+SYSTIM GetIdleTicks();
+void AdvanceDispatcher(SYSTIM ticks);
+void setWakeupHookTinyOS(void (*hook)());
+
+#ifndef _WIN32
+// POSIX ホストランタイム：tickUs マイクロ秒周期でディスパッチャーを回し続け、
+// exitTinyOS が呼ばれると戻る（startupTinyOS の後、stopRequestTinyOS の前に呼ぶ）
+// tickless を指定すると、次のタイマー満了か非タスクからの呼び出しまでホストを眠らせる
+int runTinyOS(unsigned long tickUs, bool tickless);
+// runTinyOS を抜けさせる（シグナルハンドラーや別スレッドから呼んでも良い）
+void exitTinyOS();
+#endif
+
+// ためておいたログ（KLOG_* と debug_printf）を整形して出力する
+// ホストがディスパッチの合間に呼ぶ（呼ぶのはホストの一つのスレッドだけにすること）
+void flushLogTinyOS();
+
 // for DEBUG
 void ViewTaskInfo();
+// カーネルトレースを Chrome trace JSON で書き出す（chrome://tracing や Perfetto で開ける）
+int exportTraceTinyOS(const char* path);
 
 #endif // __TINYOS_H__
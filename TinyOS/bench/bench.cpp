@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../kernel.h"
+#include "../TinyOS.h"
+#include "../port.h"
+#include "../kernelConfig.h"
+
+// カーネルのマイクロベンチマーク
+//   ホストのスレッドで startupTinyOS から cleanupTinyOS までを自分で回し、
+//   PortTimestamp で測った時間の分布を 1 行 1 結果の JSON で標準出力に書く（時間はナノ秒）
+//   カーネルは bench/benchConfig.h の構成でビルドする（Makefile の bench ターゲット）
+
+// 時間待ちの周期と、測定するティック数
+#define SLEEP_PERIOD		100
+#define SLEEP_TICKS			(10 * SLEEP_PERIOD)
+
+static const unsigned flagWaiterCounts[] = { 1, 8, 64 };
+static const unsigned sleeperCounts[] = { 10, 100, 1000, 10000, 100000 };
+
+#define COUNTOF(array)		(sizeof(array) / sizeof((array)[0]))
+
+static unsigned iterations = 100000;
+static unsigned maxSleepers = BENCH_MAX_SLEEPERS;
+
+// 測定中のタスクが書き込み、ホストが集計する（どちらもディスパッチャーのスレッド）
+static std::vector<uint64_t> samples;
+static bool benchDone;
+// 動作の確認に失敗した（終了コードを 1 にする）
+static bool benchFailed;
+
+// ------------------------------------------
+// 集計
+
+// 最近傍順位法のパーセンタイル（s は昇順に並んでいること）
+static unsigned long long Percentile(const std::vector<uint64_t>& s, double p) {
+	size_t rank = static_cast<size_t>(p * s.size() + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > s.size()) rank = s.size();
+	return s[rank - 1];
+}
+
+// param が nullptr でなければ、測定条件として "param":value を付ける
+static void Report(const char* name, const char* param, unsigned long value, std::vector<uint64_t>& s) {
+	if (s.empty()) {
+		fprintf(stderr, "%s: no samples\n", name);
+		return;
+	}
+	std::sort(s.begin(), s.end());
+	double sum = 0.0;
+	for (uint64_t v : s) sum += static_cast<double>(v);
+
+	printf("{\"bench\":\"%s\"", name);
+	if (param) printf(",\"%s\":%lu", param, value);
+	printf(",\"n\":%zu,\"mean_ns\":%.1f,\"min_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+		s.size(), sum / s.size(), static_cast<unsigned long long>(s.front()),
+		Percentile(s, 0.50), Percentile(s, 0.90), Percentile(s, 0.99), Percentile(s, 0.999),
+		static_cast<unsigned long long>(s.back()));
+	fflush(stdout);
+}
+
+// 時間を進めずに、測定中のタスクが benchDone を立てるまでディスパッチャーを回す
+static bool RunUntilDone() {
+	benchDone = false;
+	while (!benchDone) {
+		if (GetIdleTicks() == IDLE_FOREVER) {
+			fprintf(stderr, "benchmark stalled: no ready task\n");
+			return false;
+		}
+		AdvanceDispatcher(0);
+	}
+	return true;
+}
+
+// ------------------------------------------
+// TaskYield によるタスク切り替え
+//   二つのタスクが交互に DelayTask(0) で実行権を譲り、譲ってから相手が動き出すまでを測る
+
+static uint64_t switchStart;
+
+static void YieldTask(VP_INT) {
+	TASK_FOREVER {
+		uint64_t now = PortTimestamp();
+		if (benchDone) {
+			SleepTask();	// 測定が終わったら終了要求まで眠る
+			continue;
+		}
+		if (switchStart) {
+			samples.push_back(now - switchStart);
+			if (samples.size() >= iterations) benchDone = true;
+		}
+		switchStart = PortTimestamp();
+		DelayTask(0);
+	}
+}
+
+// ------------------------------------------
+// データキューの往復
+//   送ってから相手が送り返したデータを受け取るまで（2 回の送受信と 2 回の切り替え）
+
+static void PingTask(VP_INT) {
+	TASK_FOREVER {
+		if (benchDone) {
+			SleepTask();
+			continue;
+		}
+		VP_INT data;
+		uint64_t start = PortTimestamp();
+		pSendDataQueue(ID_DTQ_PING, (VP_INT)1);
+		if (ReceiveDataQueue(ID_DTQ_PONG, &data) != E_OK) continue;
+		samples.push_back(PortTimestamp() - start);
+		if (samples.size() >= iterations) benchDone = true;
+	}
+}
+
+static void PongTask(VP_INT) {
+	TASK_FOREVER {
+		VP_INT data;
+		if (ReceiveDataQueue(ID_DTQ_PING, &data) != E_OK) continue;
+		pSendDataQueue(ID_DTQ_PONG, data);
+	}
+}
+
+// ------------------------------------------
+// イベントフラグの一斉解除
+//   優先度の高い N 個のタスクが同じフラグを待ち、SetFlag から全員が起きて再び待つまでを測る
+
+static std::vector<uint64_t> flagSamples[COUNTOF(flagWaiterCounts)];
+static unsigned flagWaiters;
+static unsigned flagWoken;
+
+static void FlagWaiterTask(VP_INT) {
+	TASK_FOREVER {
+		FLGPTN flgptn;
+		if (WaitFlg(ID_FLAG_FANIN, 0x01, TWF_ORW, &flgptn) != E_OK) continue;
+		flagWoken++;
+	}
+}
+
+static void FlagControlTask(VP_INT) {
+	TASK_FOREVER {
+		if (benchDone) {
+			SleepTask();
+			continue;
+		}
+		for (size_t i = 0; i < COUNTOF(flagWaiterCounts); i++) {
+			unsigned n = std::min<unsigned>(flagWaiterCounts[i], BENCH_MAX_WAITERS);
+			while (flagWaiters < n) {
+				CreateTask(ID_TASK_FLAG_WAITER + flagWaiters, "Flag waiter", FlagWaiterTask, NULL, 2);
+				flagWaiters++;
+			}
+			DelayTask(0);	// 増やしたタスクをフラグ待ちに入れる
+			flagSamples[i].reserve(iterations);
+			for (unsigned k = 0; k < iterations; k++) {
+				flagWoken = 0;
+				uint64_t start = PortTimestamp();
+				SetFlag(ID_FLAG_FANIN, 0x01);
+				uint64_t end = PortTimestamp();
+				if (flagWoken != n) {
+					fprintf(stderr, "flag_fanin: %u of %u waiters woke up\n", flagWoken, n);
+					break;
+				}
+				flagSamples[i].push_back(end - start);
+			}
+		}
+		benchDone = true;
+	}
+}
+
+// ------------------------------------------
+// データキューの連続送信
+//   BENCH_STREAM_ITEMS 個のデータを一つずつ送る場合とまとめて送る場合で、
+//   送り始めてから優先度の高い受信タスクが全部受け取るまでを測る（組ごとにタスクとデータキューを分ける）
+
+static const unsigned streamBatches[] = { 1, BENCH_STREAM_ITEMS };
+static unsigned streamRounds;
+static uint64_t streamStart;
+
+static void StreamProducerTask(VP_INT param) {
+	unsigned batch = streamBatches[reinterpret_cast<intptr_t>(param)];
+	ID dtqid = ID_DTQ_STREAM + static_cast<ID>(reinterpret_cast<intptr_t>(param));
+	VP_INT data[BENCH_STREAM_ITEMS];
+	for (unsigned i = 0; i < BENCH_STREAM_ITEMS; i++) data[i] = (VP_INT)(intptr_t)i;
+	TASK_FOREVER {
+		if (benchDone) {
+			SleepTask();
+			continue;
+		}
+		streamStart = PortTimestamp();
+		if (batch == 1) {
+			for (unsigned i = 0; i < BENCH_STREAM_ITEMS; i++) pSendDataQueue(dtqid, data[i]);
+		}
+		else {
+			pSendDataQueueBatch(dtqid, data, BENCH_STREAM_ITEMS);
+		}
+	}
+}
+
+static void StreamConsumerTask(VP_INT param) {
+	unsigned batch = streamBatches[reinterpret_cast<intptr_t>(param)];
+	ID dtqid = ID_DTQ_STREAM + static_cast<ID>(reinterpret_cast<intptr_t>(param));
+	VP_INT data[BENCH_STREAM_ITEMS];
+	TASK_FOREVER {
+		UINT received = 0;
+		while (received < BENCH_STREAM_ITEMS) {
+			ER_UINT n;
+			if (batch == 1) {
+				n = (ReceiveDataQueue(dtqid, &data[received]) == E_OK) ? 1 : 0;
+			}
+			else {
+				UINT rest = BENCH_STREAM_ITEMS - received;
+				n = ReceiveDataQueueBatch(dtqid, &data[received], rest, rest);
+			}
+			if (n <= 0) break;	// 終了要求
+			received += n;
+		}
+		if (received < BENCH_STREAM_ITEMS) continue;
+		samples.push_back(PortTimestamp() - streamStart);
+		if (samples.size() >= streamRounds) benchDone = true;
+	}
+}
+
+// ------------------------------------------
+// 優先度継承中のミューテックス待ちの強制解除
+//   優先度の高いタスクが TA_INHERIT のミューテックスを待っている所を ActionTask で解除し、
+//   解除したタスクに切り替わって戻るまでを測る。所有タスクの優先度が元に戻ること
+//   （戻らなければ解除したタスクに切り替わらない）と待ちキューが空になることも毎回確かめる
+
+#define MTX_OWNER_PRI		4
+#define MTX_WAITER_PRI		2
+
+static ER mutexWaiterResult;
+
+static bool CheckMutex(PRI ownerPri, ID waiter) {
+	T_RTSK rtsk;
+	T_RMTX rmtx;
+	ReferenceTask(ID_TASK_MTX_OWNER, &rtsk);
+	ReferenceMutex(ID_MTX_INHERIT, &rmtx);
+	if (rtsk.tskpri == ownerPri && rmtx.htskid == ID_TASK_MTX_OWNER && rmtx.wtskid == waiter) return true;
+	fprintf(stderr, "mutex_release: owner priority %d (expected %d), waiter %d (expected %d)\n",
+		rtsk.tskpri, ownerPri, rmtx.wtskid, waiter);
+	benchFailed = true;
+	return false;
+}
+
+static void MutexWaiterTask(VP_INT) {
+	TASK_FOREVER {
+		if (SleepTask() != E_OK) continue;
+		mutexWaiterResult = LockMutex(ID_MTX_INHERIT);
+		if (mutexWaiterResult == E_OK) UnlockMutex(ID_MTX_INHERIT);
+	}
+}
+
+static void MutexOwnerTask(VP_INT) {
+	TASK_FOREVER {
+		if (benchDone) {
+			SleepTask();
+			continue;
+		}
+		LockMutex(ID_MTX_INHERIT);
+		WakeupTask(ID_TASK_MTX_WAITER);	// 優先度の高い待ちタスクがロックを待つ
+		bool ok = CheckMutex(MTX_WAITER_PRI, ID_TASK_MTX_WAITER);
+		mutexWaiterResult = E_OK;
+		uint64_t start = PortTimestamp();
+		if (ok) ActionTask(ID_TASK_MTX_WAITER);
+		uint64_t end = PortTimestamp();
+		if (ok && mutexWaiterResult != E_RLWAI) {
+			fprintf(stderr, "mutex_release: waiter did not run before the owner (%d)\n", mutexWaiterResult);
+			benchFailed = true;
+			ok = false;
+		}
+		if (ok) ok = CheckMutex(MTX_OWNER_PRI, TSK_NONE);
+		UnlockMutex(ID_MTX_INHERIT);
+		if (!ok) {
+			benchDone = true;
+			continue;
+		}
+		samples.push_back(end - start);
+		if (samples.size() >= iterations) benchDone = true;
+	}
+}
+
+// ------------------------------------------
+// 時間待ちのタスク数による 1 ティックの処理時間
+//   各タスクは SLEEP_PERIOD ティック周期で起き、起床は周期の中で均等にずらしてある
+
+static unsigned long long sleeperWakeups;
+
+static void SleeperTask(VP_INT data) {
+	DelayTask(1 + static_cast<RELTIM>(reinterpret_cast<intptr_t>(data) % SLEEP_PERIOD));
+	TASK_FOREVER {
+		sleeperWakeups++;
+		DelayTask(SLEEP_PERIOD);
+	}
+}
+
+// ------------------------------------------
+
+int configTinyOS() {
+	CreteFlag(ID_FLAG_FANIN, "Fan-in flag", TA_WMUL | TA_CLR, 0x00);
+	CreateDataQueue(ID_DTQ_PING, "Ping", 1, nullptr);
+	CreateDataQueue(ID_DTQ_PONG, "Pong", 1, nullptr);
+	for (ID dtqid = ID_DTQ_STREAM; dtqid <= ID_DTQ_STREAM_LAST; dtqid++) {
+		CreateDataQueue(dtqid, "Stream", BENCH_STREAM_ITEMS, nullptr);
+	}
+	CreateMutex(ID_MTX_INHERIT, "Inherit", TA_INHERIT, 0);
+	return 0;
+}
+
+static void BenchYield() {
+	samples.clear();
+	samples.reserve(iterations);
+	switchStart = 0;
+	CreateTask(ID_TASK_YIELD_A, "Yield A", YieldTask, NULL, 2);
+	CreateTask(ID_TASK_YIELD_B, "Yield B", YieldTask, NULL, 2);
+	if (RunUntilDone()) Report("task_switch", nullptr, 0, samples);
+}
+
+static void BenchDataQueue() {
+	samples.clear();
+	samples.reserve(iterations);
+	CreateTask(ID_TASK_PONG, "Pong", PongTask, NULL, 2);
+	CreateTask(ID_TASK_PING, "Ping", PingTask, NULL, 2);
+	if (RunUntilDone()) Report("dtq_round_trip", nullptr, 0, samples);
+}
+
+static void BenchFlag() {
+	CreateTask(ID_TASK_FLAG_CTRL, "Flag control", FlagControlTask, NULL, 3);
+	if (!RunUntilDone()) return;
+	for (size_t i = 0; i < COUNTOF(flagWaiterCounts); i++) {
+		Report("flag_fanin", "waiters", std::min<unsigned>(flagWaiterCounts[i], BENCH_MAX_WAITERS), flagSamples[i]);
+	}
+}
+
+static void BenchStream() {
+	streamRounds = std::max(iterations / BENCH_STREAM_ITEMS, 1u);
+	for (size_t i = 0; i < COUNTOF(streamBatches); i++) {
+		samples.clear();
+		samples.reserve(streamRounds);
+		CreateTask(ID_TASK_STREAM_CONSUMER + i, "Stream consumer", StreamConsumerTask, (VP_INT)(intptr_t)i, 1);
+		CreateTask(ID_TASK_STREAM_PRODUCER + i, "Stream producer", StreamProducerTask, (VP_INT)(intptr_t)i, 2);
+		if (RunUntilDone()) Report("dtq_stream", "batch", streamBatches[i], samples);
+	}
+}
+
+static void BenchMutex() {
+	samples.clear();
+	samples.reserve(iterations);
+	CreateTask(ID_TASK_MTX_WAITER, "Mutex waiter", MutexWaiterTask, NULL, MTX_WAITER_PRI);
+	CreateTask(ID_TASK_MTX_OWNER, "Mutex owner", MutexOwnerTask, NULL, MTX_OWNER_PRI);
+	if (RunUntilDone() && !benchFailed) Report("mutex_release", nullptr, 0, samples);
+}
+
+// 生成時間は時間待ちのタスクを増やすときにまとめて測る
+static void BenchSleepers() {
+	std::vector<uint64_t> createSamples;
+	std::vector<uint64_t> wakeupSamples;
+	createSamples.reserve(maxSleepers);
+	unsigned created = 0;
+
+	for (unsigned count : sleeperCounts) {
+		if (count > maxSleepers) break;
+		while (created < count) {
+			uint64_t start = PortTimestamp();
+			ER ercd = CreateTask(ID_TASK_SLEEPER + created, "Sleeper", SleeperTask, (VP_INT)(intptr_t)created, 4);
+			createSamples.push_back(PortTimestamp() - start);
+			if (ercd != E_OK) {
+				fprintf(stderr, "CreateTask failed (%d) at %u sleepers\n", ercd, created);
+				return;
+			}
+			created++;
+		}
+		// 増やしたタスクを最初の時間待ちに入れ、一周期回して起床をそろえる
+		AdvanceDispatcher(0);
+		for (unsigned tick = 0; tick < SLEEP_PERIOD; tick++) StartDispatcher();
+
+		samples.clear();
+		samples.reserve(SLEEP_TICKS);
+		wakeupSamples.clear();
+		for (unsigned tick = 0; tick < SLEEP_TICKS; tick++) {
+			unsigned long long wakeups = sleeperWakeups;
+			uint64_t start = PortTimestamp();
+			StartDispatcher();
+			uint64_t elapsed = PortTimestamp() - start;
+			samples.push_back(elapsed);
+			wakeups = sleeperWakeups - wakeups;
+			if (wakeups) wakeupSamples.push_back(elapsed / wakeups);
+		}
+		Report("delay_tick", "sleepers", count, samples);
+		Report("delay_wakeup", "sleepers", count, wakeupSamples);
+	}
+	Report("create_task", "tasks", created, createSamples);
+}
+
+// エントリーポイント
+int main(int argc, char* argv[]) {
+	// usage: TinyOSBench [-n iterations] [-s max sleepers]
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			iterations = strtoul(argv[++i], nullptr, 0);
+			continue;
+		}
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			maxSleepers = strtoul(argv[++i], nullptr, 0);
+			continue;
+		}
+		iterations = 0;
+		break;
+	}
+	if (iterations == 0 || maxSleepers > BENCH_MAX_SLEEPERS) {
+		fprintf(stderr, "usage: %s [-n iterations] [-s max sleepers (<= %d)]\n", argv[0], BENCH_MAX_SLEEPERS);
+		return 1;
+	}
+
+	if (startupTinyOS()) {
+		flushLogTinyOS();
+		return -1;
+	}
+
+	BenchYield();
+	BenchDataQueue();
+	BenchFlag();
+	BenchStream();
+	BenchMutex();
+	BenchSleepers();
+
+	stopRequestTinyOS();
+	cleanupTinyOS();
+	return benchFailed ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#ifndef __BENCH_CONFIG_H__
+#define __BENCH_CONFIG_H__
+
+// ベンチマーク用のカーネル構成（userConfig.h の代わりに TINYOS_USER_CONFIG で取り込む）
+
+// フラグ待ちのタスク数と時間待ちのタスク数の上限
+#define BENCH_MAX_WAITERS	64
+#define BENCH_MAX_SLEEPERS	100000
+// データキューの連続送信で 1 回に送るデータ数
+#define BENCH_STREAM_ITEMS	64
+
+// 眠っているタスクが多いので、スタックは小さくし、塗らずに使った分だけ実メモリーを占めるようにする
+#define TASK_STACK_SIZE		(16 * 1024)
+#define TASK_STACK_PAINT	0
+
+// 1ティックで起きるタスクをすべて回し切る
+#define DISPATCH_BUDGET		(1u << 30)
+
+// 測定に影響しないよう、ログはエラーだけ、トレースはしない
+#define KLOG_LEVEL			KLOG_LEVEL_ERROR
+#define KLOG_CATEGORIES		KLOG_CAT_ALL
+#define TRACE_BUFFER_SIZE	0
+
+enum id_task {
+	ID_TASK_YIELD_A,
+	ID_TASK_YIELD_B,
+	ID_TASK_PING,
+	ID_TASK_PONG,
+	ID_TASK_FLAG_CTRL,
+	ID_TASK_MTX_OWNER,
+	ID_TASK_MTX_WAITER,
+	ID_TASK_STREAM_PRODUCER,
+	ID_TASK_STREAM_PRODUCER_LAST = ID_TASK_STREAM_PRODUCER + 1,
+	ID_TASK_STREAM_CONSUMER,
+	ID_TASK_STREAM_CONSUMER_LAST = ID_TASK_STREAM_CONSUMER + 1,
+	ID_TASK_FLAG_WAITER,
+	ID_TASK_FLAG_WAITER_LAST = ID_TASK_FLAG_WAITER + BENCH_MAX_WAITERS - 1,
+	ID_TASK_SLEEPER,
+	ID_TASK_SLEEPER_LAST = ID_TASK_SLEEPER + BENCH_MAX_SLEEPERS - 1,
+	/* --- */
+	ID_TASK_MAX
+};
+
+enum id_flag {
+	ID_FLAG_FANIN,
+	/* --- */
+	ID_FLAG_MAX
+};
+
+enum id_dtq {
+	ID_DTQ_PING,
+	ID_DTQ_PONG,
+	ID_DTQ_STREAM,
+	ID_DTQ_STREAM_LAST = ID_DTQ_STREAM + 1,
+	/* --- */
+	ID_DTQ_MAX
+};
+
+enum id_sem {
+	/* --- */
+	ID_SEM_MAX
+};
+
+enum id_mpf {
+	/* --- */
+	ID_MPF_MAX
+};
+
+enum id_mpl {
+	/* --- */
+	ID_MPL_MAX
+};
+
+enum id_mtx {
+	ID_MTX_INHERIT,
+	/* --- */
+	ID_MTX_MAX
+};
+
+enum id_cyc {
+	/* --- */
+	ID_CYC_MAX
+};
+
+enum id_alm {
+	/* --- */
+	ID_ALM_MAX
+};
+
+#endif // __BENCH_CONFIG_H__
@@ -0,0 +1,151 @@
+#ifndef _WIN32
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <ctime>
+
+#include "kernel.h"
+#include "TinyOS.h"
+#include "kernelLog.h"
+
+// runTinyOS を起こすための eventfd と終了要求（シグナルハンドラーからも触る）
+static int hostEvent = -1;
+static volatile sig_atomic_t exitRequested = 0;
+
+// async-signal-safe
+static void WakeupHost() {
+	if (hostEvent >= 0) {
+		uint64_t one = 1;
+		ssize_t ret = write(hostEvent, &one, sizeof(one));
+		(void)ret;
+	}
+}
+
+void exitTinyOS() {
+	exitRequested = 1;
+	WakeupHost();
+}
+
+static uint64_t MonotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static struct timespec NsToTimespec(uint64_t ns) {
+	struct timespec ts;
+	ts.tv_sec = ns / 1000000000ull;
+	ts.tv_nsec = ns % 1000000000ull;
+	return ts;
+}
+
+// 周期ティック：取りこぼしたティックも含め、満了回数だけ StartDispatcher を呼ぶ
+static void RunPeriodic(int tickTimer, uint64_t tickNs) {
+	struct itimerspec its = {};
+	its.it_interval = NsToTimespec(tickNs);
+	its.it_value = its.it_interval;
+	timerfd_settime(tickTimer, 0, &its, nullptr);
+
+	struct pollfd fds[2] = {
+		{ tickTimer, POLLIN, 0 },
+		{ hostEvent, POLLIN, 0 },
+	};
+	while (!exitRequested) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			KLOG_ERROR(KLOG_CAT_SYSTEM, "Tick wait failed.\n");
+			break;
+		}
+		if (fds[1].revents & POLLIN) break;
+		if (fds[0].revents & POLLIN) {
+			uint64_t expirations;
+			if (read(tickTimer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+				// ディスパッチが長引いて取りこぼしたティックもまとめて進める
+				while (expirations--) StartDispatcher();
+			}
+			flushLogTinyOS();	// ディスパッチの合間にログを整形して出す
+		}
+	}
+}
+
+// ティックレス：次にティック処理が必要になる時刻までタイマーを一度だけ掛けて眠り、
+// 起きたら経過したティック数をまとめてカーネルに伝える
+static void RunTickless(int tickTimer, uint64_t tickNs) {
+	setWakeupHookTinyOS(WakeupHost);
+
+	uint64_t epoch = MonotonicNs();	// ティック 0 の時刻
+	SYSTIM announced = 0;			// カーネルに伝えたティック数
+
+	struct pollfd fds[2] = {
+		{ tickTimer, POLLIN, 0 },
+		{ hostEvent, POLLIN, 0 },
+	};
+	while (!exitRequested) {
+		struct itimerspec its = {};
+		SYSTIM idle = GetIdleTicks();
+		if (idle != IDLE_FOREVER) {
+			its.it_value = NsToTimespec(epoch + (announced + idle) * tickNs);
+		}
+		// it_value が 0 ならタイマーは止まり、非タスクからの呼び出しか終了要求だけを待つ
+		timerfd_settime(tickTimer, TFD_TIMER_ABSTIME, &its, nullptr);
+
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			KLOG_ERROR(KLOG_CAT_SYSTEM, "Tick wait failed.\n");
+			break;
+		}
+		uint64_t count;
+		if (fds[0].revents & POLLIN) {
+			ssize_t ret = read(tickTimer, &count, sizeof(count));
+			(void)ret;
+		}
+		if (fds[1].revents & POLLIN) {
+			ssize_t ret = read(hostEvent, &count, sizeof(count));
+			(void)ret;
+		}
+		if (exitRequested) break;
+
+		// 非タスクに起こされた場合は 0 ティックのこともある（ディスパッチだけ行う）
+		SYSTIM now = (MonotonicNs() - epoch) / tickNs;
+		SYSTIM elapsed = (now > announced) ? now - announced : 0;
+		announced += elapsed;
+		AdvanceDispatcher(elapsed);
+		flushLogTinyOS();	// ディスパッチの合間にログを整形して出す
+	}
+
+	setWakeupHookTinyOS(nullptr);
+}
+
+int runTinyOS(unsigned long tickUs, bool tickless) {
+	if (tickUs == 0) return -1;
+
+	// ティック源は CLOCK_MONOTONIC の timerfd、マイクロ秒単位の周期を指定できる
+	int tickTimer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (tickTimer < 0) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to create tick timer.\n");
+		return -1;
+	}
+	hostEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (hostEvent < 0) {
+		KLOG_ERROR(KLOG_CAT_SYSTEM, "Failed to create host event.\n");
+		close(tickTimer);
+		return -1;
+	}
+
+	uint64_t tickNs = static_cast<uint64_t>(tickUs) * 1000;
+	if (tickless) RunTickless(tickTimer, tickNs);
+	else RunPeriodic(tickTimer, tickNs);
+
+	int fd = hostEvent;
+	hostEvent = -1;
+	close(fd);
+	close(tickTimer);
+	return 0;
+}
+
+#endif // _WIN32
@@ -8,6 +8,7 @@ extern "C" {
 
 typedef int ID;
 typedef ID ER;
+typedef ER ER_UINT;	// 0 以上なら個数、負ならエラーコード
 typedef unsigned int UINT;
 typedef unsigned long UW;
 typedef char VB;
@@ -15,18 +16,130 @@ typedef void *VP;
 typedef VP VP_INT;
 typedef UINT FLGPTN;
 typedef UINT MODE;
+typedef UINT ATR;
 typedef UW RELTIM;
+typedef int PRI;
+typedef unsigned long long SYSTIM;
+typedef long TMO;
 
 #define E_OK					(0x00)	/* 00h  normal exit						*/
+#define E_NOSPT					(-9)	/* F7h  unsupported function			*/
+#define E_PAR					(-17)	/* EFh  parameter error					*/
+#define E_ID					(-18)	/* EEh  invalid ID number				*/
+#define E_CTX					(-25)	/* E7h  context error					*/
+#define E_ILUSE					(-28)	/* E4h  illegal service call use		*/
+#define E_NOMEM					(-33)	/* DFh  insufficient memory				*/
+#define E_OBJ					(-41)	/* D7h  object state error				*/
+#define E_NOEXS					(-42)	/* D6h  non-existent object				*/
+#define E_QOVR					(-43)	/* D5h  queuing overflow				*/
+#define E_RLWAI					(-49)	/* CFh  forced release from waiting		*/
+#define E_TMOUT					(-50)	/* CEh  polling failure or timeout		*/
+
+// タスク優先度の範囲（値が小さいほど優先度が高い）
+#define TMIN_TPRI	1
+#define TMAX_TPRI	32
+
+// 該当するタスクが無い（タスク ID は 0 から始まるので負の値にする）
+#define TSK_NONE	(-1)
+
+// タイムアウト指定（正の値はティック数）
+#define TMO_POL		0		// 待たずに戻る（ポーリング）
+#define TMO_FEVR	(-1)	// 永久に待つ
+
+// キューイングできる起床要求の最大数
+#define TMAX_WUPCNT	255
+
+// タスクの待ち要因
+#define TTW_SLP		0x0001u
+#define TTW_DLY		0x0002u
+#define TTW_SEM		0x0004u
+#define TTW_FLG		0x0008u
+#define TTW_SDTQ	0x0010u
+#define TTW_RDTQ	0x0020u
+#define TTW_MTX		0x0080u
+#define TTW_MPF		0x2000u
+#define TTW_MPL		0x4000u
+
+// タスク属性
+//   TA_GUARD : カーネルが確保するスタックの下にガードページを置き、あふれたら即座に落とす
+//              （Win32 では OS のガードページに任せるので無視する、呼び出し元のスタックには付けられない）
+#define TA_GUARD    0x10u
+
+// イベントフラグ属性
+//   TA_WSGL : 待てるタスクは一つだけ（二つ目の WaitFlg は E_ILUSE）
+//   TA_WMUL : 複数のタスクが待てる、iSetFlag で条件を満たしたタスクをすべて解除する
+//   TA_CLR  : 待ちを解除したら（その時点で条件を満たしたタスクをすべて解除した後で）パターンを 0 にする
+#define TA_WSGL     0x00u
+#define TA_WMUL     0x02u
+#define TA_CLR      0x04u
+
+// ミューテックス属性（待ちキューはどれも優先度順）
+//   TA_TPRI    : 優先度を変えない
+//   TA_INHERIT : 優先度継承（所有タスクを待ちタスクの最高優先度まで上げる、待ちの連鎖もたどる）
+//   TA_CEILING : 優先度上限（ロックしている間は ceilpri まで上げる）
+#define TA_TPRI     0x01u
+#define TA_INHERIT  0x02u
+#define TA_CEILING  0x03u
+
+// 周期ハンドラー属性
+//   TA_STA : 生成したときに動作を始める
+//   TA_PHS : 起動位相を保つ（止めてから再開しても、生成時の位相と周期で決まる時刻に起動する）
+#define TA_STA      0x02u
+#define TA_PHS      0x04u
 
 // フラグ操作モードの定義
 #define TWF_ANDW    0x00u
 #define TWF_ORW     0x01u
 
+// ReferenceTask のタスク状態
+#define TTS_RUN		0x01u	// 実行状態（自タスクを参照したとき）
+#define TTS_RDY		0x02u	// 実行可能状態
+#define TTS_WAI		0x04u	// 待ち状態
+#define TTS_DMT		0x10u	// 終了要求済み
+
+// ReferenceCyclicHandler / ReferenceAlarmHandler の動作状態
+#define TCYC_STP	0x00u
+#define TCYC_STA	0x01u
+#define TALM_STP	0x00u
+#define TALM_STA	0x01u
+
+// T_RTSK::waittim の添字（待ち要因ごとの累積待ち時間）
+#define TSTAT_WAIT_SLP		0
+#define TSTAT_WAIT_DLY		1
+#define TSTAT_WAIT_FLG		2
+#define TSTAT_WAIT_SDTQ		3
+#define TSTAT_WAIT_RDTQ		4
+#define TSTAT_WAIT_MPF		5
+#define TSTAT_WAIT_MPL		6
+#define TSTAT_WAIT_MTX		7
+#define TSTAT_WAIT_SEM		8
+#define TNUM_TSTAT_WAIT		9
+
+// T_RTSK::latency の区間数：待ち解除からディスパッチまでの時間を 2 のべき乗のマイクロ秒で区切って数える
+// （k 番は [2^(k-1), 2^k) マイクロ秒、0 番は 1 マイクロ秒未満、最後の区間はそれ以上をすべて含む）
+#define TNUM_TSTAT_LATENCY	16
+
+// 時間はホストの単調時刻のナノ秒
+typedef struct t_rtsk {
+	UINT        tskstat;
+	PRI         tskpri;		// 現在優先度（ミューテックスで引き上げられていればその値）
+	PRI         tskbpri;	// ベース優先度
+	UINT        tskwait;	// 待ち要因（TTW_*、待ち状態でなければ 0）
+	UINT        wupcnt;
+	VB    const *name;
+	UINT        dspcnt;		// ディスパッチされた回数
+	unsigned long long runtim;						// 実行していた時間の累計
+	unsigned long long waittim[TNUM_TSTAT_WAIT];	// 待ち要因ごとの待ち時間の累計
+	UINT        latency[TNUM_TSTAT_LATENCY];		// 待ち解除からディスパッチまでの時間の度数分布
+	UINT        stksz;		// スタックサイズ（バイト、TA_GUARD ではページ単位に切り上げた大きさ）
+	UINT        stkused;	// スタック使用量の最大値（バイト、TASK_STACK_PAINT が 0 か測れないホストでは 0）
+} T_RTSK;
+
 typedef struct t_rflg {
 	ID          wtskid;
 	FLGPTN      flgptn;
 	VB    const *name;
+	UINT        waicnt;		// これまでに待ち状態に入ったタスクの延べ数
 } T_RFLG;
 
 typedef struct t_rdtq {
@@ -34,38 +147,192 @@ typedef struct t_rdtq {
 	ID          rtskid;
 	UINT        sdtqcnt;
 	VB    const *name;
+	UINT        sdtqmax;	// 貯まっていたデータ数の最大値
 } T_RDTQ;
 
+typedef struct t_rsem {
+	ID          wtskid;
+	UINT        semcnt;		// 資源数
+	VB    const *name;
+	UINT        semmax;		// 最大資源数
+} T_RSEM;
+
+typedef struct t_rmpf {
+	ID          wtskid;
+	UINT        fblkcnt;	// 空きブロック数
+	VB    const *name;
+	UINT        fblkmin;	// 空きブロック数の最小値
+} T_RMPF;
+
+typedef struct t_rmpl {
+	ID          wtskid;
+	UINT        fmplsz;		// 空き領域の合計（バイト）
+	UINT        fblksz;		// 今すぐ確実に取得できる大きさ（バイト）
+	VB    const *name;
+	UINT        fblkcnt;	// 空きブロックの数
+	UINT        fmplmin;	// fmplsz の最小値
+	UINT        mplfrag;	// 断片化率（%）：100 - 最大の空きブロック * 100 / fmplsz
+} T_RMPL;
+
+typedef struct t_rmtx {
+	ID          htskid;		// ロックしているタスク（無ければ TSK_NONE）
+	ID          wtskid;
+	VB    const *name;
+} T_RMTX;
+
+typedef struct t_rcyc {
+	UINT        cycstat;	// TCYC_STA / TCYC_STP
+	RELTIM      lefttim;	// 次に起動するまでのティック数（止まっていれば 0）
+	VB    const *name;
+	UINT        actcnt;		// 起動した回数
+} T_RCYC;
+
+typedef struct t_ralm {
+	UINT        almstat;	// TALM_STA / TALM_STP
+	RELTIM      lefttim;	// 起動するまでのティック数（止まっていれば 0）
+	VB    const *name;
+	UINT        actcnt;		// 起動した回数
+} T_RALM;
+
 // タスクの関数プロトタイプ
 typedef void (*TaskFunction)(VP_INT);
+// 周期・アラームハンドラーの関数プロトタイプ
+typedef void (*HandlerFunction)(VP_INT);
+
+// i* は非タスク（割り込みやホストの別スレッド）から呼ぶ。ロックを取らずに要求を積むだけで、
+// 処理は次にディスパッチャーが動いたときに行う（戻り値は ID の検査と要求の受付の結果）
+// 待ち状態に入る呼び出しの p* は待たずに E_TMOUT を返し、t* は tmout ティック待って E_TMOUT を返す
+// （t* に TMO_POL を渡せば p*、TMO_FEVR を渡せば待ち続けるものと同じ）
+// 終了要求済みのタスク（stopRequestTinyOS の後、cleanupTinyOS でタスク関数から抜けるまでを含む）が呼ぶと、
+// i* と参照系（Reference*・GetTime）以外は何もせずに E_RLWAI を返す
+
+// タスクの生成にはこの関数を使用する（スタックは TASK_STACK_SIZE バイトをカーネルが確保する）
+ER CreateTask(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData, PRI itskpri);
+// スタックを指定して生成する：stksz が 0 なら TASK_STACK_SIZE、stk が NULL ならカーネルが確保する
+// stk を渡すときは stksz バイトの領域（ポインタ境界）で、タスクを削除するまで残しておくこと
+// （呼び出し元のスタックを使えないホストでは E_NOSPT）
+ER CreateTaskStack(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData, PRI itskpri,
+	ATR tskatr, UINT stksz, VP stk);
+ER ActionTask(ID tskid);
+ER TermitTask(ID tskid);
+ER SleepTask();
+ER tSleepTask(TMO tmout);	// TMO_POL なら起床要求があれば一つ消費し、無ければ E_TMOUT
+ER iWakeupTask(ID tskid);
+ER WakeupTask(ID tskid);
+ER DelayTask(RELTIM dlytim);
+ER GetTime(SYSTIM* p_systim);
+ER ReferenceTask(ID tskid, T_RTSK *pk_rtsk);
+
+// 実行権の譲渡：待ちを解除する呼び出しは、実行中タスクより優先度の高いタスクがレディーになったときだけ実行権を譲る
+// （同じ優先度のタスクに譲るには DelayTask(0) を使う）。ディスパッチ禁止・CPU ロックの区間では譲らずに、
+// EnableDispatch / UnlockCpu でまとめて判断する。区間の中で待ちに入る呼び出し（DelayTask(0) を含む）は E_CTX
+ER DisableDispatch();
+ER EnableDispatch();
+ER LockCpu();
+ER UnlockCpu();
+
+ER CreteFlag(ID flgid, const char* name, ATR flgatr, FLGPTN iflgptn);
+ER iSetFlag(ID flgid, FLGPTN setptn);
+ER SetFlag(ID flgid, FLGPTN setptn);
+ER ClearFlag(ID flgid, FLGPTN clearptn);
+ER WaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn);
+ER pWaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn);
+ER tWaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn, TMO tmout);
+ER ReferenceFlg(ID flgid, T_RFLG *pk_rflg);
+
+// dtqcnt はキューに貯められるデータ数（0 なら送信と受信を直接受け渡す）
+// dtq に dtqcnt 個分の領域（dtqcnt は 2 のべき乗）を渡すか、nullptr ならカーネルが確保する
+// SendDataQueue は満杯なら空くまで待ち、pSendDataQueue / iSendDataQueue は満杯なら E_TMOUT を返す
+// ReceiveDataQueue は空なら届くまで待ち、pReceiveDataQueue は空なら E_TMOUT を返す
+ER CreateDataQueue(ID dtqid, const char* name, UINT dtqcnt, VP_INT* dtq);
+ER SendDataQueue(ID dtqid, VP_INT data);
+ER iSendDataQueue(ID dtqid, VP_INT data);
+ER pSendDataQueue(ID dtqid, VP_INT data);
+ER tSendDataQueue(ID dtqid, VP_INT data, TMO tmout);
+ER ReceiveDataQueue(ID dtqid, VP_INT *p_data);
+ER pReceiveDataQueue(ID dtqid, VP_INT *p_data);
+ER tReceiveDataQueue(ID dtqid, VP_INT *p_data, TMO tmout);
+ER ReferenceDataQueue(ID dtqid, T_RDTQ *pk_rdtq);
+// まとめ送受信：一つずつ呼ぶのと同じ順に受け渡し、実行権を譲るのは一回だけ
+// 戻り値は送受信できた数（一つもできなければエラーコード、途中で待ちが解除されたら送受信できた分の数）
+// Send*Batch は cnt 個すべてを送るまで空きを待ち、pSendDataQueueBatch は送れる分だけ送る
+// Receive*Batch は maxcnt 個まで受け取り、mincnt 個に満たなければ届くまで待つ
+// pReceiveDataQueueBatch は今あるだけ受け取る。t* の tmout は呼び出し全体の期限
+ER_UINT SendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt);
+ER_UINT pSendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt);
+ER_UINT tSendDataQueueBatch(ID dtqid, const VP_INT *data, UINT cnt, TMO tmout);
+ER_UINT ReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt, UINT mincnt);
+ER_UINT pReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt);
+ER_UINT tReceiveDataQueueBatch(ID dtqid, VP_INT *p_data, UINT maxcnt, UINT mincnt, TMO tmout);
+
+// カウンティングセマフォ：資源数を isemcnt から始め、maxsem を超えて返却すると E_QOVR
+// 返却・獲得とも cnt 個をまとめて扱う（cnt は 1 以上、獲得は maxsem 以下）。
+// 足りなければ WaitSemaphore は返却されるまで待ち、待ちは到着順に満たす（先のタスクを追い越さない）。
+// pWaitSemaphore は E_TMOUT、tWaitSemaphore は tmout ティック待って E_TMOUT を返す
+ER CreateSemaphore(ID semid, const char* name, UINT isemcnt, UINT maxsem);
+ER SignalSemaphore(ID semid, UINT cnt);
+ER iSignalSemaphore(ID semid, UINT cnt);
+ER WaitSemaphore(ID semid, UINT cnt);
+ER pWaitSemaphore(ID semid, UINT cnt);
+ER tWaitSemaphore(ID semid, UINT cnt, TMO tmout);
+ER ReferenceSemaphore(ID semid, T_RSEM *pk_rsem);
+
+// 固定長メモリープール：blksz バイトのブロックを blkcnt 個持つ
+// mpf に領域（blkcnt * blksz をポインタのサイズに切り上げたもの、ポインタ境界に置くこと）を渡すか、
+// nullptr ならカーネルが確保する。空きブロックが無ければ GetFixedMemoryPool は返却されるまで待ち（到着順）、
+// pGetFixedMemoryPool は E_TMOUT、tGetFixedMemoryPool は tmout ティック待って E_TMOUT を返す
+ER CreateFixedMemoryPool(ID mpfid, const char* name, UINT blkcnt, UINT blksz, VP mpf);
+ER GetFixedMemoryPool(ID mpfid, VP *p_blk);
+ER pGetFixedMemoryPool(ID mpfid, VP *p_blk);
+ER tGetFixedMemoryPool(ID mpfid, VP *p_blk, TMO tmout);
+ER ReleaseFixedMemoryPool(ID mpfid, VP blk);
+ER ReferenceFixedMemoryPool(ID mpfid, T_RMPF *pk_rmpf);
+
+// 可変長メモリープール：mplsz バイトの領域から TLSF で任意の大きさのブロックを切り出す
+// mpl に領域（ポインタ境界に置くこと）を渡すか、nullptr ならカーネルが確保する。
+// 足りなければ GetVariableMemoryPool は返却されるまで待ち、待ちは到着順に満たす（先のタスクを追い越さない）
+ER CreateVariableMemoryPool(ID mplid, const char* name, UINT mplsz, VP mpl);
+ER GetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk);
+ER pGetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk);
+ER tGetVariableMemoryPool(ID mplid, UINT blksz, VP *p_blk, TMO tmout);
+ER ReleaseVariableMemoryPool(ID mplid, VP blk);
+ER ReferenceVariableMemoryPool(ID mplid, T_RMPL *pk_rmpl);
+
+// ミューテックス：ロックしたタスクだけがアンロックでき、同じタスクが二重にロックすると E_ILUSE
+// ロックしたまま終了したタスクのミューテックスは、終了時に次の待ちタスクへ渡す
+// TA_CEILING でベース優先度が ceilpri より高いタスクがロックすると E_ILUSE（ceilpri はそれ以外では使わない）
+// ロック・アンロックとも非タスク（ハンドラー）から呼ぶと E_CTX
+ER CreateMutex(ID mtxid, const char* name, ATR mtxatr, PRI ceilpri);
+ER LockMutex(ID mtxid);
+ER pLockMutex(ID mtxid);
+ER tLockMutex(ID mtxid, TMO tmout);
+ER UnlockMutex(ID mtxid);
+ER ReferenceMutex(ID mtxid, T_RMTX *pk_rmtx);
+
+// 周期ハンドラー・アラームハンドラー：タイマーが満了したティックの処理の中で、ディスパッチャーのスレッドから
+// 非タスクとして呼ばれる。ハンドラーから呼べるのは i* と、以下のハンドラーの操作だけ（待ちに入る呼び出しは不可）。
+// 以下の操作はタスクとハンドラーから呼ぶ（ホストの別スレッドからは呼ばないこと）。
+// 周期ハンドラーは cycphs ティック目に最初に起動し、以後は前回の起動時刻に cyctim を足した時刻に起動する
+// （ハンドラーやタスクの処理が遅れても、起動時刻はずれていかない）。cycphs は cyctim 以下であること。
+// TA_PHS が無ければ StartCyclicHandler の cyctim ティック後から数え直す
+ER CreateCyclicHandler(ID cycid, const char* name, ATR cycatr, HandlerFunction cychdr, VP_INT exinf, RELTIM cyctim, RELTIM cycphs);
+ER StartCyclicHandler(ID cycid);
+ER StopCyclicHandler(ID cycid);
+ER ReferenceCyclicHandler(ID cycid, T_RCYC *pk_rcyc);
 
-// タスクの生成にはこの関数を使用する
-void CreateTask(ID tskid, const char* name, TaskFunction taskFunction, VP_INT taskData);
-void ActionTask(ID tskid);
-void TermitTask(ID tskid);
-void SleepTask();
-void iWakeupTask(ID tskid);
-void WakeupTask(ID tskid);
-void DelayTask(RELTIM dlytim);
-
-void CreteFlag(ID flgid, const char* name, FLGPTN iflgptn);
-void iSetFlag(ID flgid, FLGPTN setptn);
-void SetFlag(ID flgid, FLGPTN setptn);
-void ClearFlag(ID flgid, FLGPTN clearptn);
-void WaitFlg(ID flgid, FLGPTN waiptn, MODE wfmode, FLGPTN *p_flgptn);
-void ReferenceFlg(ID flgid, T_RFLG *pk_rflg);
-
-void CreateDataQueue(ID dtqid, const char* name);
-void iSendDataQueue(ID dtqid, VP_INT data);
-void pSendDataQueue(ID dtqid, VP_INT data);
-void ReceiveDataQueue(ID dtqid, VP_INT *p_data);
-void ReferenceDataQueue(ID dtqid, T_RDTQ *pk_rdtq);
+// アラームハンドラーは StartAlarmHandler の almtim ティック後に一度だけ起動する（動作中に呼べば設定し直す）
+ER CreateAlarmHandler(ID almid, const char* name, HandlerFunction almhdr, VP_INT exinf);
+ER StartAlarmHandler(ID almid, RELTIM almtim);
+ER StopAlarmHandler(ID almid);
+ER ReferenceAlarmHandler(ID almid, T_RALM *pk_ralm);
 
 bool isTaskExist();
 // タスクを無限ループで実行する場合はこのマクロを使用すること
 #define TASK_FOREVER while(isTaskExist())
 
 /* for DEBUG */
+// 整形は後でホストが flushLogTinyOS を呼んだときに行う。format はリテラルにすること
+// （%s の文字列は呼び出し時に写すので一時的なバッファでも良い、合わせて KLOG_TEXT_SIZE バイトまで）
 void debug_printf(const char* format, ...);
 
 #ifdef __cplusplus
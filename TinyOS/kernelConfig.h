@@ -0,0 +1,13 @@
+#ifndef __KERNEL_CONFIG_H__
+#define __KERNEL_CONFIG_H__
+
+// カーネルが取り込むユーザー構成（ID の列挙と各種の上限）
+//   既定は userConfig.h、別の構成でカーネルをビルドするときはコンパイラーの引数で差し替える
+//   （例：ベンチマークは -DTINYOS_USER_CONFIG='"bench/benchConfig.h"'）
+#ifdef TINYOS_USER_CONFIG
+#include TINYOS_USER_CONFIG
+#else
+#include "userConfig.h"
+#endif
+
+#endif // __KERNEL_CONFIG_H__
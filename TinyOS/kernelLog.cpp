@@ -0,0 +1,211 @@
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "kernelLog.h"
+#include "mpscRing.h"
+#include "port.h"
+#include "TinyOS.h"
+
+static MpscRing<LogRecord, KLOG_BUFFER_SIZE> logQueue;
+static std::atomic<unsigned> logDropped;
+
+// %s の文字列を記録の中に写す（出力する前に呼び出し元のバッファが無くなっても良いように）
+// シグナルハンドラーからも呼ばれるので、ライブラリー関数は使わない
+static void LogCopyStrings(LogRecord& record) {
+	size_t used = 0;
+	for (unsigned i = 0; i < record.count; i++) {
+		LogArg& arg = record.args[i];
+		if (arg.type != LOG_ARG_STRING) continue;
+		const char* str = arg.p ? static_cast<const char*>(arg.p) : "(null)";
+		arg.type = LOG_ARG_TEXT;
+		arg.u = used;	// 入り切らなければ KLOG_TEXT_SIZE になり、空の文字列として出す
+		while (*str && used + 1 < KLOG_TEXT_SIZE) record.text[used++] = *str++;
+		if (used < KLOG_TEXT_SIZE) record.text[used++] = '\0';
+	}
+}
+
+void LogPost(LogRecord& record) {
+	LogCopyStrings(record);
+	if (!logQueue.push(record)) logDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 変換指定（'%' から変換文字まで）
+struct LogSpec {
+	const char* begin;
+	const char* end;
+	char length[3];		// "", "h", "hh", "l", "ll", "z", "j", "t", "L"
+	char conv;
+};
+
+// p は '%' の次を指していること
+static const char* LogParseSpec(const char* p, LogSpec* spec) {
+	spec->begin = p - 1;
+	while (*p && strchr("-+ #0", *p)) p++;
+	while (*p >= '0' && *p <= '9') p++;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9') p++;
+	}
+	int n = 0;
+	while (n < 2 && *p && strchr("hlzjtL", *p)) spec->length[n++] = *p++;
+	spec->length[n] = '\0';
+	spec->conv = *p;
+	if (*p) p++;
+	spec->end = p;
+	return p;
+}
+
+static bool IsSignedConv(char c) { return c == 'd' || c == 'i'; }
+static bool IsUnsignedConv(char c) { return c == 'u' || c == 'o' || c == 'x' || c == 'X'; }
+static bool IsDoubleConv(char c) { return c && strchr("fFeEgGaA", c) != nullptr; }
+
+void LogWriteV(const char* format, va_list args) {
+	LogRecord record;
+	record.format = format;
+	record.count = 0;
+	for (const char* p = format; *p && record.count < KLOG_MAX_ARGS; ) {
+		if (*p++ != '%') continue;
+		if (*p == '%') {
+			p++;
+			continue;
+		}
+		LogSpec spec;
+		p = LogParseSpec(p, &spec);
+		const char* len = spec.length;
+		LogArg& arg = record.args[record.count];
+		if (IsSignedConv(spec.conv) || spec.conv == 'c') {
+			if (!strcmp(len, "l")) arg = LogArgSigned(va_arg(args, long));
+			else if (!strcmp(len, "ll")) arg = LogArgSigned(va_arg(args, long long));
+			else if (!strcmp(len, "z") || !strcmp(len, "t")) arg = LogArgSigned(va_arg(args, ptrdiff_t));
+			else if (!strcmp(len, "j")) arg = LogArgSigned(va_arg(args, intmax_t));
+			else arg = LogArgSigned(va_arg(args, int));
+		}
+		else if (IsUnsignedConv(spec.conv)) {
+			if (!strcmp(len, "l")) arg = LogArgUnsigned(va_arg(args, unsigned long));
+			else if (!strcmp(len, "ll")) arg = LogArgUnsigned(va_arg(args, unsigned long long));
+			else if (!strcmp(len, "z") || !strcmp(len, "t")) arg = LogArgUnsigned(va_arg(args, size_t));
+			else if (!strcmp(len, "j")) arg = LogArgUnsigned(va_arg(args, uintmax_t));
+			else arg = LogArgUnsigned(va_arg(args, unsigned int));
+		}
+		else if (IsDoubleConv(spec.conv)) {
+			if (!strcmp(len, "L")) arg = LogArgDouble(static_cast<double>(va_arg(args, long double)));
+			else arg = LogArgDouble(va_arg(args, double));
+		}
+		else if (spec.conv == 's') {
+			arg = LogArgPointer(LOG_ARG_STRING, va_arg(args, const char*));
+		}
+		else if (spec.conv == 'p') {
+			arg = LogArgPointer(LOG_ARG_POINTER, va_arg(args, void*));
+		}
+		else {
+			continue;	// 対応しない変換指定は引数を取らずにそのまま出す
+		}
+		record.count++;
+	}
+	LogPost(record);
+}
+
+static long long AsSigned(const LogArg& arg) {
+	switch (arg.type) {
+	case LOG_ARG_DOUBLE:	return static_cast<long long>(arg.d);
+	case LOG_ARG_STRING:
+	case LOG_ARG_POINTER:	return static_cast<long long>(reinterpret_cast<intptr_t>(arg.p));
+	case LOG_ARG_TEXT:		return 0;
+	default:				return arg.i;
+	}
+}
+
+static double AsDouble(const LogArg& arg) {
+	switch (arg.type) {
+	case LOG_ARG_DOUBLE:	return arg.d;
+	case LOG_ARG_UNSIGNED:	return static_cast<double>(arg.u);
+	case LOG_ARG_SIGNED:	return static_cast<double>(arg.i);
+	default:				return 0.0;
+	}
+}
+
+// 変換指定一つ分を、長さ修飾子が期待する型に戻してから snprintf で整形する
+static int LogFormatArg(char* out, size_t size, const char* spec, const LogSpec& s, const LogArg& arg) {
+	const char* len = s.length;
+	if (IsSignedConv(s.conv) || s.conv == 'c') {
+		long long v = AsSigned(arg);
+		if (!strcmp(len, "l")) return snprintf(out, size, spec, static_cast<long>(v));
+		if (!strcmp(len, "ll")) return snprintf(out, size, spec, v);
+		if (!strcmp(len, "z") || !strcmp(len, "t")) return snprintf(out, size, spec, static_cast<ptrdiff_t>(v));
+		if (!strcmp(len, "j")) return snprintf(out, size, spec, static_cast<intmax_t>(v));
+		return snprintf(out, size, spec, static_cast<int>(v));
+	}
+	if (IsUnsignedConv(s.conv)) {
+		unsigned long long v = static_cast<unsigned long long>(AsSigned(arg));
+		if (!strcmp(len, "l")) return snprintf(out, size, spec, static_cast<unsigned long>(v));
+		if (!strcmp(len, "ll")) return snprintf(out, size, spec, v);
+		if (!strcmp(len, "z") || !strcmp(len, "t")) return snprintf(out, size, spec, static_cast<size_t>(v));
+		if (!strcmp(len, "j")) return snprintf(out, size, spec, static_cast<uintmax_t>(v));
+		return snprintf(out, size, spec, static_cast<unsigned int>(v));
+	}
+	if (IsDoubleConv(s.conv)) {
+		if (!strcmp(len, "L")) return snprintf(out, size, spec, static_cast<long double>(AsDouble(arg)));
+		return snprintf(out, size, spec, AsDouble(arg));
+	}
+	if (s.conv == 's') {
+		const char* str = (arg.type == LOG_ARG_STRING || arg.type == LOG_ARG_POINTER) ? static_cast<const char*>(arg.p) : nullptr;
+		return snprintf(out, size, spec, str ? str : "(null)");
+	}
+	return snprintf(out, size, spec, arg.p);	// %p
+}
+
+static void LogFormat(const LogRecord& record, char* out, size_t size) {
+	size_t pos = 0;
+	unsigned index = 0;
+	for (const char* p = record.format; *p && pos + 1 < size; ) {
+		if (*p != '%') {
+			out[pos++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			out[pos++] = '%';
+			p += 2;
+			continue;
+		}
+		LogSpec spec;
+		p = LogParseSpec(p + 1, &spec);
+		size_t specLength = spec.end - spec.begin;
+		bool known = IsSignedConv(spec.conv) || IsUnsignedConv(spec.conv) || IsDoubleConv(spec.conv)
+			|| spec.conv == 'c' || spec.conv == 's' || spec.conv == 'p';
+		if (!known || index >= record.count || specLength >= 32) {
+			// 対応しない変換指定や引数の足りない分は書式のまま出す
+			size_t n = (specLength < size - 1 - pos) ? specLength : size - 1 - pos;
+			memcpy(out + pos, spec.begin, n);
+			pos += n;
+			continue;
+		}
+		char specText[32];
+		memcpy(specText, spec.begin, specLength);
+		specText[specLength] = '\0';
+		LogArg arg = record.args[index++];
+		if (arg.type == LOG_ARG_TEXT) {
+			arg = LogArgPointer(LOG_ARG_STRING, (arg.u < KLOG_TEXT_SIZE) ? record.text + arg.u : "");
+		}
+		int n = LogFormatArg(out + pos, size - pos, specText, spec, arg);
+		if (n > 0) pos += (static_cast<size_t>(n) < size - pos) ? n : size - 1 - pos;
+	}
+	out[pos] = '\0';
+}
+
+void flushLogTinyOS() {
+	char line[1024];
+	LogRecord record;
+	while (logQueue.pop(&record)) {
+		LogFormat(record, line, sizeof(line));
+		PortDebugOutput(line);
+	}
+	unsigned dropped = logDropped.exchange(0, std::memory_order_relaxed);
+	if (dropped) {
+		snprintf(line, sizeof(line), "%u log record(s) dropped\n", dropped);
+		PortDebugOutput(line);
+	}
+}
@@ -0,0 +1,131 @@
+#ifndef __KERNEL_LOG_H__
+#define __KERNEL_LOG_H__
+
+#include <cstdarg>
+#include <cstdint>
+
+#include "kernelConfig.h"
+
+// カーネルのログ
+//   レベルとカテゴリーはコンパイル時に絞り込み、対象外の KLOG_* は引数の評価も含めて消える。
+//   記録時は書式文字列のポインタと引数の値だけをロックフリーのリングに積み、
+//   文字列への整形と出力は後でホストが flushLogTinyOS を呼んだときにまとめて行う
+//   （別スレッドで出力するのではなく、ホストがディスパッチの合間に呼ぶ）。
+//   書式文字列は出力されるまで残っているもの（リテラル）に限ること。%s に渡す文字列は記録時に
+//   レコードの中に写すので一時的なバッファでも良い（合わせて KLOG_TEXT_SIZE バイトまで、超えた分は切り詰める）。
+//   幅・精度の '*' と %n には対応しない。引数は KLOG_MAX_ARGS 個まで（debug_printf で超えた分は書式のまま出る）。
+
+#define KLOG_LEVEL_NONE		0
+#define KLOG_LEVEL_ERROR	1
+#define KLOG_LEVEL_WARN		2
+#define KLOG_LEVEL_INFO		3
+#define KLOG_LEVEL_DEBUG	4
+
+#define KLOG_CAT_SYSTEM		0x0001u		// 起動・終了・資源の確保
+#define KLOG_CAT_SCHED		0x0002u		// ディスパッチ
+#define KLOG_CAT_TASK		0x0004u		// タスクの起床・時間待ち
+#define KLOG_CAT_FLAG		0x0008u		// イベントフラグ
+#define KLOG_CAT_DTQ		0x0010u		// データキュー
+#define KLOG_CAT_USER		0x0100u		// debug_printf
+#define KLOG_CAT_ALL		0xFFFFu
+
+// 出力するレベルとカテゴリー（userConfig.h で変更できる）
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL			KLOG_LEVEL_INFO
+#endif
+#ifndef KLOG_CATEGORIES
+#define KLOG_CATEGORIES		KLOG_CAT_ALL
+#endif
+
+// 整形待ちのログをためておける数（2 のべき乗、あふれた分は捨てて数だけ報告する）
+#ifndef KLOG_BUFFER_SIZE
+#define KLOG_BUFFER_SIZE	1024
+#endif
+
+#define KLOG_MAX_ARGS		6
+
+// 一つの記録で %s の文字列を写しておける大きさ（終端の '\0' を含む）
+#ifndef KLOG_TEXT_SIZE
+#define KLOG_TEXT_SIZE		128
+#endif
+
+enum LogArgType : uint8_t {
+	LOG_ARG_SIGNED,
+	LOG_ARG_UNSIGNED,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_STRING,
+	LOG_ARG_POINTER,
+	LOG_ARG_TEXT,		// LogRecord::text に写した文字列（u が先頭の位置）
+};
+
+struct LogArg {
+	LogArgType type;
+	union {
+		long long i;
+		unsigned long long u;
+		double d;
+		const void* p;
+	};
+};
+
+struct LogRecord {
+	const char* format;
+	uint8_t count;
+	LogArg args[KLOG_MAX_ARGS];
+	char text[KLOG_TEXT_SIZE];
+};
+
+static inline LogArg LogArgSigned(long long v) { LogArg a; a.type = LOG_ARG_SIGNED; a.i = v; return a; }
+static inline LogArg LogArgUnsigned(unsigned long long v) { LogArg a; a.type = LOG_ARG_UNSIGNED; a.u = v; return a; }
+static inline LogArg LogArgDouble(double v) { LogArg a; a.type = LOG_ARG_DOUBLE; a.d = v; return a; }
+static inline LogArg LogArgPointer(LogArgType type, const void* v) { LogArg a; a.type = type; a.p = v; return a; }
+
+// 引数の型ごとに値を取り込む（列挙型は int への格上げで LogArgOf(int) になる）
+static inline LogArg LogArgOf(bool v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(char v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(signed char v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(unsigned char v) { return LogArgUnsigned(v); }
+static inline LogArg LogArgOf(short v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(unsigned short v) { return LogArgUnsigned(v); }
+static inline LogArg LogArgOf(int v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(unsigned int v) { return LogArgUnsigned(v); }
+static inline LogArg LogArgOf(long v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(unsigned long v) { return LogArgUnsigned(v); }
+static inline LogArg LogArgOf(long long v) { return LogArgSigned(v); }
+static inline LogArg LogArgOf(unsigned long long v) { return LogArgUnsigned(v); }
+static inline LogArg LogArgOf(float v) { return LogArgDouble(v); }
+static inline LogArg LogArgOf(double v) { return LogArgDouble(v); }
+static inline LogArg LogArgOf(const char* v) { return LogArgPointer(LOG_ARG_STRING, v); }
+static inline LogArg LogArgOf(char* v) { return LogArgPointer(LOG_ARG_STRING, v); }
+template <typename T>
+static inline LogArg LogArgOf(T* v) { return LogArgPointer(LOG_ARG_POINTER, v); }
+
+// 記録をリングに積む（どのスレッドからでも良い、満杯なら捨てる）
+// LOG_ARG_STRING の引数はここで record.text に写して LOG_ARG_TEXT にする
+void LogPost(LogRecord& record);
+
+template <typename... Args>
+static inline void LogWrite(const char* format, Args... args) {
+	static_assert(sizeof...(Args) <= KLOG_MAX_ARGS, "too many log arguments");
+	LogArg values[sizeof...(Args) + 1] = { LogArgOf(args)..., LogArgSigned(0) };
+	LogRecord record;
+	record.format = format;
+	record.count = sizeof...(Args);
+	for (unsigned i = 0; i < sizeof...(Args); i++) record.args[i] = values[i];
+	LogPost(record);
+}
+
+// va_list の引数を書式文字列に従って取り込む（debug_printf 用）
+void LogWriteV(const char* format, va_list args);
+
+#define KLOG_ENABLED(level, category)	((level) <= KLOG_LEVEL && ((category) & KLOG_CATEGORIES) != 0)
+
+#define KLOG(level, category, ...) \
+	do { if (KLOG_ENABLED(level, category)) LogWrite(__VA_ARGS__); } while (0)
+
+#define KLOG_ERROR(category, ...)	KLOG(KLOG_LEVEL_ERROR, category, __VA_ARGS__)
+#define KLOG_WARN(category, ...)	KLOG(KLOG_LEVEL_WARN, category, __VA_ARGS__)
+#define KLOG_INFO(category, ...)	KLOG(KLOG_LEVEL_INFO, category, __VA_ARGS__)
+#define KLOG_DEBUG(category, ...)	KLOG(KLOG_LEVEL_DEBUG, category, __VA_ARGS__)
+
+#endif // __KERNEL_LOG_H__
@@ -0,0 +1,64 @@
+#ifndef _WIN32
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernel.h"
+#include "TinyOS.h"
+
+// ティック周期（マイクロ秒）、引数で変更できる
+#define DEFAULT_TICK_US		500000UL
+
+static void SignalHandler(int) {
+	exitTinyOS();
+}
+
+// エントリーポイント
+int main(int argc, char* argv[]) {
+	// usage: TinyOS [-l] [-t trace.json] [tick period in microseconds]
+	//   -l : ティックレス（次のタイマー満了までホストを眠らせる）
+	//   -t : 終了時にカーネルトレースを Chrome trace JSON で書き出す
+	unsigned long tickUs = DEFAULT_TICK_US;
+	bool tickless = false;
+	const char* tracePath = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-l") == 0) {
+			tickless = true;
+			continue;
+		}
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			tracePath = argv[++i];
+			continue;
+		}
+		tickUs = strtoul(argv[i], nullptr, 0);
+		if (tickUs == 0) {
+			fprintf(stderr, "usage: %s [-l] [-t trace.json] [tick period in microseconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	struct sigaction sa = {};
+	sa.sa_handler = SignalHandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	if (startupTinyOS()) {
+		debug_printf("Failed to setup TinyOS.\n");
+		flushLogTinyOS();
+		return -1;
+	}
+
+	runTinyOS(tickUs, tickless);
+
+	stopRequestTinyOS();
+	cleanupTinyOS();
+	if (tracePath && exportTraceTinyOS(tracePath) != 0) {
+		fprintf(stderr, "Failed to write trace to %s\n", tracePath);
+	}
+	return 0;
+}
+
+#endif // _WIN32
@@ -0,0 +1,83 @@
+﻿#ifdef _WIN32
+
+#include <windows.h>
+
+#include "kernel.h"
+#include "TinyOS.h"
+
+enum {
+	WM_USER_TIMER = WM_USER + 1,
+};
+
+// ウィンドウプロシージャ
+LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+	case WM_CREATE:
+		SetTimer(hWnd, WM_USER_TIMER, 500, nullptr); // タイマーイベントを設定
+		break;
+	case WM_CLOSE:
+		stopRequestTinyOS();
+		KillTimer(hWnd, WM_USER_TIMER); // タイマーイベントを破棄
+		cleanupTinyOS();
+		DestroyWindow(hWnd);
+		break;
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        break;
+	case WM_TIMER:	// タイマーイベント
+		if (wParam == WM_USER_TIMER) {
+			StartDispatcher();
+		}
+		flushLogTinyOS();	// ディスパッチの合間にログを整形して出す
+		break;
+    default:
+        return DefWindowProc(hWnd, msg, wParam, lParam);
+    }
+    return 0;
+}
+
+// エントリーポイント
+int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
+    // ウィンドウクラスの登録
+    WNDCLASS wc = {};
+    wc.lpfnWndProc = WndProc;
+    wc.hInstance = hInstance;
+    wc.lpszClassName = TEXT("TinyOSWindowClass");
+    RegisterClass(&wc);
+
+    // ウィンドウの作成
+    HWND hWnd = CreateWindowEx(
+        0,
+        wc.lpszClassName,
+        TEXT("TinyOS"),
+        WS_OVERLAPPEDWINDOW,
+        CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT, CW_USEDEFAULT,
+        NULL,
+        NULL,
+        hInstance,
+        NULL
+    );
+
+    if (hWnd == NULL) {
+        return 0;
+    }
+
+    ShowWindow(hWnd, nCmdShow);
+
+	if (startupTinyOS()) {
+		debug_printf("Failed to setup TinyOS.\n");
+		flushLogTinyOS();
+		return -1;
+	}
+
+    // メッセージループ
+    MSG msg = {};
+    while (GetMessage(&msg, NULL, 0, 0)) {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    return 0;
+}
+
+#endif // _WIN32
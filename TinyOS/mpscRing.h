@@ -0,0 +1,69 @@
+#ifndef __MPSC_RING_H__
+#define __MPSC_RING_H__
+
+#include <atomic>
+#include <cstddef>
+
+// 固定長のロックフリー MPSC リング（複数の書き手、一つの読み手）
+//   push : どのスレッド・シグナルハンドラーからでも呼べる（ロックもメモリ確保もしない）
+//   pop  : 読み手（ディスパッチャー）だけが呼ぶ
+// 各セルに通し番号を持たせ、書き手は末尾の番号を CAS で取ってから値を書き、番号を進めて公開する。
+// 書き手が公開前に割り込まれても、読み手はそのセルの手前で止まるだけで待ち合わせはしない。
+template <typename T, size_t SIZE>
+class MpscRing {
+	static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+public:
+	MpscRing() : tail_(0), head_(0) {
+		for (size_t i = 0; i < SIZE; i++) cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// 満杯なら false
+	bool push(const T& value) {
+		size_t pos = tail_.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = cells_[pos & (SIZE - 1)];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			if (sequence == pos) {
+				if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (sequence < pos) {
+				return false;	// 読み手がまだ一周前の値を取り出していない
+			}
+			else {
+				pos = tail_.load(std::memory_order_relaxed);	// 他の書き手に先を越された
+			}
+		}
+	}
+
+	// 空（または先頭がまだ公開されていない）なら false
+	bool pop(T* value) {
+		Cell& cell = cells_[head_ & (SIZE - 1)];
+		if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) return false;
+		*value = cell.value;
+		cell.sequence.store(head_ + SIZE, std::memory_order_release);
+		head_++;
+		return true;
+	}
+
+	// 読み手から見て取り出せるものが無いか
+	bool empty() const {
+		return cells_[head_ & (SIZE - 1)].sequence.load(std::memory_order_acquire) != head_ + 1;
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	Cell cells_[SIZE];
+	alignas(64) std::atomic<size_t> tail_;	// 書き手どうしで取り合う
+	alignas(64) size_t head_;				// 読み手だけが触る
+};
+
+#endif // __MPSC_RING_H__
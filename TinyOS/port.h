@@ -0,0 +1,89 @@
+#ifndef __PORT_H__
+#define __PORT_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// ホスト依存部：タスクコンテキストの生成と切り替え、デバッグ出力
+// （カーネルはディスパッチャーのスレッドだけで動くので、排他は持たない）
+//   Win32         : ファイバー
+//   x86-64 (ELF)  : 呼び出し先保存レジスタだけを退避するアセンブラ実装
+//   その他の POSIX : ucontext
+
+typedef void (*PortEntry)(void*);
+
+#if defined(_WIN32)
+struct PortContext {
+	void* fiber;
+	PortEntry entry;
+	void* arg;
+};
+#elif defined(__x86_64__) && defined(__ELF__)
+#define PORT_ASM_SWITCH
+struct PortContext {
+	void* sp;			// 退避したスタックポインタ
+	void* stack;		// スタック領域（ディスパッチャーは nullptr）
+	size_t stackSize;
+	void* allocation;	// 自分で確保した領域（呼び出し元のスタックなら nullptr）
+	size_t mapSize;		// ガードページ付きで mmap した大きさ（malloc なら 0）
+	bool painted;		// PORT_STACK_PAINT で塗った
+};
+#else
+#include <ucontext.h>
+struct PortContext {
+	ucontext_t uc;
+	void* stack;		// スタック領域（ディスパッチャーは nullptr）
+	size_t stackSize;
+	void* allocation;	// 自分で確保した領域（呼び出し元のスタックなら nullptr）
+	size_t mapSize;		// ガードページ付きで mmap した大きさ（malloc なら 0）
+	bool painted;		// PORT_STACK_PAINT で塗った
+	PortEntry entry;
+	void* arg;
+};
+#endif
+
+// 呼び出し元が用意したスタックでコンテキストを作れる（Win32 のファイバーは OS がスタックを確保する）
+#ifndef _WIN32
+#define PORT_USER_STACK
+#endif
+
+// タスクのスタックの最小サイズ（バイト）
+#define PORT_STACK_MIN		4096
+
+// 呼び出し元スレッドをディスパッチャーのコンテキストとして登録する
+bool PortInitMainContext(PortContext* ctx);
+void PortExitMainContext(PortContext* ctx);
+
+// PortCreateContext の flags
+//   PORT_STACK_GUARD : 一番下にアクセスできないガードページを置き、あふれたら即座に落とす
+//                      （カーネルが確保するスタックだけ、Win32 は OS のガードページに任せる）
+//   PORT_STACK_PAINT : スタック全体を PORT_STACK_FILL で塗り、PortStackUsed で使われた深さを調べられるようにする。
+//                      塗るとスタックのすべてのページが実メモリーを占める（mmap やガードページ付きでも遅延確保されない）ので、
+//                      タスクが多いときは付けないこと
+#define PORT_STACK_GUARD	0x01u
+#define PORT_STACK_PAINT	0x02u
+
+// stackSize バイトのスタックで entry(arg) から実行を始めるコンテキストを生成する
+// stack が nullptr なら専用スタックを確保する。stack を渡した場合（PORT_USER_STACK のホストだけ）は
+// それを使い、PortDeleteContext でも解放しない
+// *p_stackSize には実際に使えるスタックの大きさを返す（PORT_STACK_GUARD ではページ単位に切り上げる）
+// entry から戻ってはいけない（最後は必ず他のコンテキストへ切り替えること）
+bool PortCreateContext(PortContext* ctx, void* stack, size_t stackSize, unsigned flags, PortEntry entry, void* arg,
+	size_t* p_stackSize);
+void PortDeleteContext(PortContext* ctx);
+
+#define PORT_STACK_FILL		0xA5
+
+// スタックの塗りつぶしが書き換えられた範囲（これまでの最大使用量、塗っていないか測れないホストでは 0）
+size_t PortStackUsed(const PortContext* ctx);
+
+// 現在の実行状態を from に退避し、to の実行を再開する
+void PortSwitchContext(PortContext* from, PortContext* to);
+
+// 単調増加するホストの時刻（ナノ秒、トレースの時刻に使う）
+uint64_t PortTimestamp();
+
+// デバッグ文字列の出力先
+void PortDebugOutput(const char* str);
+
+#endif // __PORT_H__
@@ -0,0 +1,182 @@
+#ifndef _WIN32
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "port.h"
+
+bool PortInitMainContext(PortContext* ctx) {
+	// 初回の切り替えで現在の状態が退避されるので、ここでは空にしておくだけ
+	memset(ctx, 0, sizeof(*ctx));
+	return true;
+}
+
+void PortExitMainContext(PortContext*) {
+}
+
+// スタックを用意する（ガードページは mmap した領域の一番下のページ）
+static bool PortAllocStack(PortContext* ctx, void* stack, size_t stackSize, unsigned flags) {
+	ctx->allocation = nullptr;
+	ctx->mapSize = 0;
+	if (stack == nullptr && (flags & PORT_STACK_GUARD)) {
+		size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		stackSize = (stackSize + page - 1) & ~(page - 1);
+		void* base = mmap(nullptr, stackSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) return false;
+		if (mprotect(base, page, PROT_NONE) != 0) {
+			munmap(base, stackSize + page);
+			return false;
+		}
+		ctx->allocation = base;
+		ctx->mapSize = stackSize + page;
+		stack = static_cast<char*>(base) + page;
+	}
+	else if (stack == nullptr) {
+		stack = ctx->allocation = malloc(stackSize);
+		if (stack == nullptr) return false;
+	}
+	ctx->stack = stack;
+	ctx->stackSize = stackSize;
+	ctx->painted = (flags & PORT_STACK_PAINT) != 0;
+	if (ctx->painted) memset(stack, PORT_STACK_FILL, stackSize);
+	return true;
+}
+
+void PortDeleteContext(PortContext* ctx) {
+	if (ctx->mapSize) munmap(ctx->allocation, ctx->mapSize);
+	else free(ctx->allocation);
+	ctx->allocation = nullptr;
+	ctx->mapSize = 0;
+	ctx->stack = nullptr;
+	ctx->stackSize = 0;
+}
+
+// スタックは下に伸びるので、低い番地から塗りつぶしが残っている所までを数える
+size_t PortStackUsed(const PortContext* ctx) {
+	const unsigned char* stack = static_cast<const unsigned char*>(ctx->stack);
+	if (stack == nullptr || !ctx->painted) return 0;
+	size_t untouched = 0;
+	while (untouched < ctx->stackSize && stack[untouched] == PORT_STACK_FILL) untouched++;
+	return ctx->stackSize - untouched;
+}
+
+#ifdef PORT_ASM_SWITCH
+
+// SysV ABI の呼び出し先保存レジスタ（rbp, rbx, r12-r15）と MXCSR / x87 制御ワードだけを
+// 切り替え元のスタックに積み、スタックポインタを差し替える
+asm(
+	".text\n"
+	".globl tinyos_port_switch\n"
+	".hidden tinyos_port_switch\n"
+	".type tinyos_port_switch, @function\n"
+	"tinyos_port_switch:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size tinyos_port_switch, .-tinyos_port_switch\n"
+	// 新しいコンテキストの最初の ret はここに戻る（r12 = entry, r13 = arg）
+	".globl tinyos_port_start\n"
+	".hidden tinyos_port_start\n"
+	".type tinyos_port_start, @function\n"
+	"tinyos_port_start:\n"
+	"	movq %r13, %rdi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size tinyos_port_start, .-tinyos_port_start\n"
+);
+
+extern "C" void tinyos_port_switch(void** save_sp, void* load_sp);
+extern "C" void tinyos_port_start();
+
+bool PortCreateContext(PortContext* ctx, void* stack, size_t stackSize, unsigned flags, PortEntry entry, void* arg,
+	size_t* p_stackSize) {
+	if (!PortAllocStack(ctx, stack, stackSize, flags)) return false;
+	*p_stackSize = ctx->stackSize;
+
+	// tinyos_port_switch が復帰するときのフレームを積んでおく
+	uintptr_t top = (reinterpret_cast<uintptr_t>(ctx->stack) + ctx->stackSize) & ~static_cast<uintptr_t>(15);
+	uint64_t* frame = reinterpret_cast<uint64_t*>(top - 16) - 8;
+	frame[0] = 0x1F80 | (static_cast<uint64_t>(0x037F) << 32);	// MXCSR / x87 制御ワードの初期値
+	frame[1] = 0;												// r15
+	frame[2] = 0;												// r14
+	frame[3] = reinterpret_cast<uint64_t>(arg);				// r13
+	frame[4] = reinterpret_cast<uint64_t>(entry);				// r12
+	frame[5] = 0;												// rbx
+	frame[6] = 0;												// rbp
+	frame[7] = reinterpret_cast<uint64_t>(&tinyos_port_start);	// 戻り先
+	ctx->sp = frame;
+	return true;
+}
+
+void PortSwitchContext(PortContext* from, PortContext* to) {
+	tinyos_port_switch(&from->sp, to->sp);
+}
+
+#else // PORT_ASM_SWITCH
+
+// makecontext には int しか渡せないので、ポインタを上位・下位に分けて渡す
+static void PortStartContext(unsigned int hi, unsigned int lo) {
+	PortContext* ctx = reinterpret_cast<PortContext*>(static_cast<uintptr_t>((static_cast<unsigned long long>(hi) << 32) | lo));
+	ctx->entry(ctx->arg);
+}
+
+bool PortCreateContext(PortContext* ctx, void* stack, size_t stackSize, unsigned flags, PortEntry entry, void* arg,
+	size_t* p_stackSize) {
+	if (!PortAllocStack(ctx, stack, stackSize, flags)) return false;
+	*p_stackSize = ctx->stackSize;
+	ctx->entry = entry;
+	ctx->arg = arg;
+
+	if (getcontext(&ctx->uc) != 0) {
+		PortDeleteContext(ctx);
+		return false;
+	}
+	ctx->uc.uc_stack.ss_sp = ctx->stack;
+	ctx->uc.uc_stack.ss_size = ctx->stackSize;
+	ctx->uc.uc_link = nullptr;
+	unsigned long long p = reinterpret_cast<uintptr_t>(ctx);
+	makecontext(&ctx->uc, reinterpret_cast<void (*)()>(PortStartContext), 2,
+		static_cast<unsigned int>(p >> 32), static_cast<unsigned int>(p));
+	return true;
+}
+
+void PortSwitchContext(PortContext* from, PortContext* to) {
+	swapcontext(&from->uc, &to->uc);
+}
+
+#endif // PORT_ASM_SWITCH
+
+uint64_t PortTimestamp() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+void PortDebugOutput(const char* str) {
+	fputs(str, stderr);
+}
+
+#endif // _WIN32
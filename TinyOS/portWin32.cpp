@@ -0,0 +1,67 @@
+#ifdef _WIN32
+
+#include <windows.h>
+
+#include "port.h"
+
+static VOID CALLBACK PortFiberProc(LPVOID param) {
+	PortContext* ctx = static_cast<PortContext*>(param);
+	ctx->entry(ctx->arg);
+}
+
+bool PortInitMainContext(PortContext* ctx) {
+	ctx->fiber = ConvertThreadToFiber(nullptr);
+	if (ctx->fiber == nullptr && GetLastError() == ERROR_ALREADY_FIBER) {
+		ctx->fiber = GetCurrentFiber();
+	}
+	return ctx->fiber != nullptr;
+}
+
+void PortExitMainContext(PortContext* ctx) {
+	ConvertFiberToThread();
+	ctx->fiber = nullptr;
+}
+
+// 予約サイズも stackSize にして、既定（実行ファイルのヘッダーの値、普通は 1MB）の予約を避ける
+// 呼び出し元のスタックは使えず、ガードページは OS が置くものに任せる（大きさは要求のまま返す）
+bool PortCreateContext(PortContext* ctx, void* stack, size_t stackSize, unsigned, PortEntry entry, void* arg,
+	size_t* p_stackSize) {
+	if (stack) return false;
+	*p_stackSize = stackSize;
+	ctx->entry = entry;
+	ctx->arg = arg;
+	ctx->fiber = CreateFiberEx(stackSize, stackSize, FIBER_FLAG_FLOAT_SWITCH, PortFiberProc, ctx);
+	return ctx->fiber != nullptr;
+}
+
+void PortDeleteContext(PortContext* ctx) {
+	if (ctx->fiber) DeleteFiber(ctx->fiber);
+	ctx->fiber = nullptr;
+}
+
+// ファイバーのスタックは OS が確保するので塗れない
+size_t PortStackUsed(const PortContext*) {
+	return 0;
+}
+
+void PortSwitchContext(PortContext*, PortContext* to) {
+	// ファイバーは切り替え元の状態を自前で退避する
+	SwitchToFiber(to->fiber);
+}
+
+uint64_t PortTimestamp() {
+	static LARGE_INTEGER frequency;
+	if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	uint64_t ticks = static_cast<uint64_t>(counter.QuadPart);
+	uint64_t freq = static_cast<uint64_t>(frequency.QuadPart);
+	// 桁あふれしないよう、秒と端数に分けて換算する
+	return (ticks / freq) * 1000000000ull + (ticks % freq) * 1000000000ull / freq;
+}
+
+void PortDebugOutput(const char* str) {
+	OutputDebugStringA(str);
+}
+
+#endif // _WIN32
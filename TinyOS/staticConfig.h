@@ -0,0 +1,105 @@
+#ifndef __STATIC_CONFIG_H__
+#define __STATIC_CONFIG_H__
+
+#include <cstddef>
+
+#include "kernel.h"
+
+// 静的な構成
+//   タスク・イベントフラグ・データキューを constexpr の表で宣言し、スタックとキューの領域は静的な配列で渡す。
+//   表は ID の順（userConfig.h の列挙の順）にすべての ID を並べ、StaticTableValid で抜けや順序の誤りを
+//   コンパイル時に検出する。configTinyOS で CreateStatic* を呼べば、ヒープを使わずに生成できる
+//   （管理ブロックは ContextManager の静的な配列、使うメモリーはリンク時に決まる）。
+//   Win32 のファイバーはスタックを OS が確保するので、タスクのスタックの配列は大きさだけを使う。
+
+struct StaticTask {
+	ID id;
+	const char* name;
+	TaskFunction task;
+	VP_INT exinf;
+	PRI itskpri;
+	ATR tskatr;
+	UINT stksz;
+	VP stk;
+};
+
+struct StaticFlag {
+	ID id;
+	const char* name;
+	ATR flgatr;
+	FLGPTN iflgptn;
+};
+
+struct StaticDataQueue {
+	ID id;
+	const char* name;
+	UINT dtqcnt;		// 2 のべき乗（0 なら直接受け渡し）
+	VP_INT* dtq;
+};
+
+// 配列の大きさを取り込んで表の要素を作る（スタックはポインタ境界にそろえること）
+template <size_t N>
+constexpr StaticTask StaticTaskEntry(ID id, const char* name, TaskFunction task, VP_INT exinf, PRI itskpri,
+	ATR tskatr, char (&stack)[N]) {
+	return StaticTask{ id, name, task, exinf, itskpri, tskatr, static_cast<UINT>(N), stack };
+}
+
+template <size_t N>
+constexpr StaticDataQueue StaticDataQueueEntry(ID id, const char* name, VP_INT (&buffer)[N]) {
+	static_assert((N & (N - 1)) == 0, "data queue buffer must be a power of two");
+	return StaticDataQueue{ id, name, static_cast<UINT>(N), buffer };
+}
+
+// 表が 0～count-1 の ID を順に並べている
+template <typename T, size_t N>
+constexpr bool StaticTableValid(const T (&table)[N], unsigned count) {
+	if (N != count) return false;
+	for (size_t i = 0; i < N; i++) {
+		if (table[i].id != static_cast<ID>(i)) return false;
+	}
+	return true;
+}
+
+// 表のオブジェクトを順に生成する（最初に失敗したときのエラーコードを返す、configTinyOS はそれを返して起動を止めること）
+template <size_t N>
+static inline ER CreateStaticTasks(const StaticTask (&table)[N]) {
+	for (const StaticTask& t : table) {
+#ifdef _WIN32
+		VP stk = NULL;	// ファイバーのスタックは OS が確保する
+#else
+		VP stk = t.stk;
+#endif
+		ER ercd = CreateTaskStack(t.id, t.name, t.task, t.exinf, t.itskpri, t.tskatr, t.stksz, stk);
+		if (ercd != E_OK) {
+			debug_printf("Failed to create %s (%d)\n", t.name, ercd);
+			return ercd;
+		}
+	}
+	return E_OK;
+}
+
+template <size_t N>
+static inline ER CreateStaticFlags(const StaticFlag (&table)[N]) {
+	for (const StaticFlag& f : table) {
+		ER ercd = CreteFlag(f.id, f.name, f.flgatr, f.iflgptn);
+		if (ercd != E_OK) {
+			debug_printf("Failed to create %s (%d)\n", f.name, ercd);
+			return ercd;
+		}
+	}
+	return E_OK;
+}
+
+template <size_t N>
+static inline ER CreateStaticDataQueues(const StaticDataQueue (&table)[N]) {
+	for (const StaticDataQueue& d : table) {
+		ER ercd = CreateDataQueue(d.id, d.name, d.dtqcnt, d.dtq);
+		if (ercd != E_OK) {
+			debug_printf("Failed to create %s (%d)\n", d.name, ercd);
+			return ercd;
+		}
+	}
+	return E_OK;
+}
+
+#endif // __STATIC_CONFIG_H__
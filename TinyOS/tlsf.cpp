@@ -0,0 +1,263 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "tlsf.h"
+
+// ブロックのヘッダー
+//   prevPhys は物理的に前のブロックが空きのときだけ有効で、前のブロックのペイロードの末尾に重なる
+//   nextFree / prevFree は自分が空きのときだけ有効で、自分のペイロードの先頭に重なる
+// 使用中のブロックが実際に占めるヘッダーは size だけになる
+struct TlsfBlock {
+	TlsfBlock* prevPhys;
+	size_t size;			// ペイロードの大きさ | BLOCK_FREE | BLOCK_PREV_FREE
+	TlsfBlock* nextFree;
+	TlsfBlock* prevFree;
+};
+
+static const size_t BLOCK_FREE = 1;
+static const size_t BLOCK_PREV_FREE = 2;
+static const size_t BLOCK_OVERHEAD = sizeof(size_t);
+static const size_t BLOCK_START_OFFSET = offsetof(TlsfBlock, size) + sizeof(size_t);
+static const size_t BLOCK_SIZE_MIN = sizeof(TlsfBlock) - sizeof(TlsfBlock*);
+static const size_t BLOCK_SIZE_MAX = static_cast<size_t>(1) << TLSF_FL_INDEX_MAX;
+
+static_assert(TLSF_FL_INDEX_COUNT <= 32, "first-level bitmap must fit in 32 bits");
+static_assert(TLSF_SL_INDEX_COUNT <= 32, "second-level bitmap must fit in 32 bits");
+
+// 最下位・最上位の 1 のビット位置（bits != 0）
+static inline int TlsfFfs(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (int)index;
+#else
+	return __builtin_ctz(bits);
+#endif
+}
+
+static inline int TlsfFls(uint32_t bits) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, bits);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(bits);
+#endif
+}
+
+static inline int TlsfFlsSize(size_t size) {
+	uint64_t bits = size;
+	return (bits >> 32) ? TlsfFls(static_cast<uint32_t>(bits >> 32)) + 32 : TlsfFls(static_cast<uint32_t>(bits));
+}
+
+static inline size_t BlockSize(const TlsfBlock* block) {
+	return block->size & ~(BLOCK_FREE | BLOCK_PREV_FREE);
+}
+
+static inline void BlockSetSize(TlsfBlock* block, size_t size) {
+	block->size = size | (block->size & (BLOCK_FREE | BLOCK_PREV_FREE));
+}
+
+static inline bool BlockIsFree(const TlsfBlock* block) {
+	return (block->size & BLOCK_FREE) != 0;
+}
+
+static inline bool BlockIsPrevFree(const TlsfBlock* block) {
+	return (block->size & BLOCK_PREV_FREE) != 0;
+}
+
+static inline char* BlockPayload(TlsfBlock* block) {
+	return reinterpret_cast<char*>(block) + BLOCK_START_OFFSET;
+}
+
+static inline TlsfBlock* BlockFromPayload(void* ptr) {
+	return reinterpret_cast<TlsfBlock*>(static_cast<char*>(ptr) - BLOCK_START_OFFSET);
+}
+
+static inline TlsfBlock* BlockNext(TlsfBlock* block) {
+	return reinterpret_cast<TlsfBlock*>(BlockPayload(block) + BlockSize(block) - BLOCK_OVERHEAD);
+}
+
+// 次のブロックから自分をたどれるようにする
+static inline TlsfBlock* BlockLinkNext(TlsfBlock* block) {
+	TlsfBlock* next = BlockNext(block);
+	next->prevPhys = block;
+	return next;
+}
+
+static inline void BlockMarkFree(TlsfBlock* block) {
+	TlsfBlock* next = BlockLinkNext(block);
+	next->size |= BLOCK_PREV_FREE;
+	block->size |= BLOCK_FREE;
+}
+
+static inline void BlockMarkUsed(TlsfBlock* block) {
+	TlsfBlock* next = BlockNext(block);
+	next->size &= ~BLOCK_PREV_FREE;
+	block->size &= ~BLOCK_FREE;
+}
+
+// 大きさが属する区間
+static inline void MappingInsert(size_t size, int* fl, int* sl) {
+	if (size < TLSF_SMALL_BLOCK_SIZE) {
+		*fl = 0;
+		*sl = static_cast<int>(size / (TLSF_SMALL_BLOCK_SIZE / TLSF_SL_INDEX_COUNT));
+	}
+	else {
+		int bit = TlsfFlsSize(size);
+		*sl = static_cast<int>(size >> (bit - TLSF_SL_INDEX_COUNT_LOG2)) ^ TLSF_SL_INDEX_COUNT;
+		*fl = bit - (TLSF_FL_INDEX_SHIFT - 1);
+	}
+}
+
+// 要求を区間の上端に切り上げ、その区間のブロックならどれでも足りるようにする
+static inline void MappingSearch(size_t size, int* fl, int* sl) {
+	if (size >= TLSF_SMALL_BLOCK_SIZE) {
+		size += (static_cast<size_t>(1) << (TlsfFlsSize(size) - TLSF_SL_INDEX_COUNT_LOG2)) - 1;
+	}
+	MappingInsert(size, fl, sl);
+}
+
+// (fl, sl) 以上で空でない最初の区間の先頭ブロック
+static TlsfBlock* SearchSuitable(Tlsf* tlsf, int* fl, int* sl) {
+	uint32_t slMap = tlsf->slBitmap[*fl] & (~0u << *sl);
+	if (!slMap) {
+		uint32_t flMap = (*fl + 1 < 32) ? tlsf->flBitmap & (~0u << (*fl + 1)) : 0;
+		if (!flMap) return nullptr;
+		*fl = TlsfFfs(flMap);
+		slMap = tlsf->slBitmap[*fl];
+	}
+	*sl = TlsfFfs(slMap);
+	return tlsf->blocks[*fl][*sl];
+}
+
+static void InsertFree(Tlsf* tlsf, TlsfBlock* block) {
+	int fl, sl;
+	MappingInsert(BlockSize(block), &fl, &sl);
+	TlsfBlock* head = tlsf->blocks[fl][sl];
+	block->nextFree = head;
+	block->prevFree = nullptr;
+	if (head) head->prevFree = block;
+	tlsf->blocks[fl][sl] = block;
+	tlsf->flBitmap |= 1u << fl;
+	tlsf->slBitmap[fl] |= 1u << sl;
+	tlsf->freeBytes += BlockSize(block);
+	tlsf->freeBlocks++;
+}
+
+static void RemoveFree(Tlsf* tlsf, TlsfBlock* block) {
+	int fl, sl;
+	MappingInsert(BlockSize(block), &fl, &sl);
+	if (block->nextFree) block->nextFree->prevFree = block->prevFree;
+	if (block->prevFree) {
+		block->prevFree->nextFree = block->nextFree;
+	}
+	else {
+		tlsf->blocks[fl][sl] = block->nextFree;
+		if (!block->nextFree) {
+			tlsf->slBitmap[fl] &= ~(1u << sl);
+			if (!tlsf->slBitmap[fl]) tlsf->flBitmap &= ~(1u << fl);
+		}
+	}
+	tlsf->freeBytes -= BlockSize(block);
+	tlsf->freeBlocks--;
+}
+
+bool TlsfInit(Tlsf* tlsf, void* mem, size_t bytes) {
+	memset(tlsf, 0, sizeof(*tlsf));
+	if (reinterpret_cast<uintptr_t>(mem) % TLSF_ALIGN_SIZE || bytes < 2 * BLOCK_OVERHEAD + BLOCK_SIZE_MIN) return false;
+
+	// 領域全体を一つの空きブロックにし、末尾に大きさ 0 の使用中ブロックを番兵として置く
+	// （先頭のブロックの prevPhys は領域の外になるが、前が空きになることは無いので触らない）
+	size_t poolBytes = (bytes - 2 * BLOCK_OVERHEAD) & ~static_cast<size_t>(TLSF_ALIGN_SIZE - 1);
+	if (poolBytes >= BLOCK_SIZE_MAX) poolBytes = BLOCK_SIZE_MAX - TLSF_ALIGN_SIZE;
+	TlsfBlock* block = reinterpret_cast<TlsfBlock*>(static_cast<char*>(mem) - BLOCK_OVERHEAD);
+	block->size = poolBytes;
+	TlsfBlock* sentinel = BlockLinkNext(block);
+	sentinel->size = 0;
+	BlockMarkFree(block);
+	InsertFree(tlsf, block);
+
+	tlsf->area = static_cast<char*>(mem);
+	tlsf->areaSize = bytes;
+	tlsf->capacity = poolBytes;
+	tlsf->minFreeBytes = tlsf->freeBytes;
+	return true;
+}
+
+void* TlsfAlloc(Tlsf* tlsf, size_t size) {
+	if (size == 0 || size > tlsf->capacity) return nullptr;
+	size_t adjust = (size + TLSF_ALIGN_SIZE - 1) & ~static_cast<size_t>(TLSF_ALIGN_SIZE - 1);
+	if (adjust < BLOCK_SIZE_MIN) adjust = BLOCK_SIZE_MIN;
+
+	int fl, sl;
+	MappingSearch(adjust, &fl, &sl);
+	TlsfBlock* block = (fl < TLSF_FL_INDEX_COUNT) ? SearchSuitable(tlsf, &fl, &sl) : nullptr;
+	if (!block) {
+		// 切り上げた区間より上に無ければ、要求と同じ区間の先頭だけは調べる（プールいっぱいの要求も取れるように）
+		MappingInsert(adjust, &fl, &sl);
+		block = tlsf->blocks[fl][sl];
+		if (!block || BlockSize(block) < adjust) return nullptr;
+	}
+	RemoveFree(tlsf, block);
+
+	// 余りで一つのブロックが作れるなら切り分けて空きに戻す
+	if (BlockSize(block) >= adjust + sizeof(TlsfBlock)) {
+		TlsfBlock* rest = reinterpret_cast<TlsfBlock*>(BlockPayload(block) + adjust - BLOCK_OVERHEAD);
+		rest->size = BlockSize(block) - adjust - BLOCK_OVERHEAD;
+		BlockSetSize(block, adjust);
+		BlockMarkFree(rest);
+		InsertFree(tlsf, rest);
+	}
+	BlockMarkUsed(block);
+	if (tlsf->freeBytes < tlsf->minFreeBytes) tlsf->minFreeBytes = tlsf->freeBytes;
+	return BlockPayload(block);
+}
+
+bool TlsfFree(Tlsf* tlsf, void* ptr) {
+	// 分かる範囲で、このプールから取得したブロックかどうかを確かめる
+	char* payload = static_cast<char*>(ptr);
+	char* end = tlsf->area + tlsf->areaSize;
+	if (payload < tlsf->area + BLOCK_OVERHEAD || payload >= end || reinterpret_cast<uintptr_t>(payload) % TLSF_ALIGN_SIZE) return false;
+	TlsfBlock* block = BlockFromPayload(ptr);
+	if (BlockIsFree(block) || BlockSize(block) < BLOCK_SIZE_MIN || BlockSize(block) > static_cast<size_t>(end - payload)) return false;
+
+	BlockMarkFree(block);
+	// 物理的に前後の空きブロックと結合する
+	if (BlockIsPrevFree(block)) {
+		TlsfBlock* prev = block->prevPhys;
+		RemoveFree(tlsf, prev);
+		BlockSetSize(prev, BlockSize(prev) + BlockSize(block) + BLOCK_OVERHEAD);
+		block = prev;
+		BlockLinkNext(block);
+	}
+	TlsfBlock* next = BlockNext(block);
+	if (BlockIsFree(next)) {
+		RemoveFree(tlsf, next);
+		BlockSetSize(block, BlockSize(block) + BlockSize(next) + BLOCK_OVERHEAD);
+		BlockLinkNext(block);
+	}
+	InsertFree(tlsf, block);
+	return true;
+}
+
+void TlsfGetStats(const Tlsf* tlsf, TlsfStats* stats) {
+	stats->freeBytes = tlsf->freeBytes;
+	stats->minFreeBytes = tlsf->minFreeBytes;
+	stats->freeBlocks = tlsf->freeBlocks;
+	stats->largestFree = 0;
+	stats->allocatable = 0;
+	if (!tlsf->flBitmap) return;
+	// 最大のブロックは一番上の区間にある（区間の中は並んでいないので、そのリストだけをたどる）
+	int fl = TlsfFls(tlsf->flBitmap);
+	int sl = TlsfFls(tlsf->slBitmap[fl]);
+	for (const TlsfBlock* block = tlsf->blocks[fl][sl]; block; block = block->nextFree) {
+		if (BlockSize(block) > stats->largestFree) stats->largestFree = BlockSize(block);
+	}
+	// TlsfAlloc はその区間の先頭ブロックの大きさまでの要求なら必ず満たせる
+	stats->allocatable = BlockSize(tlsf->blocks[fl][sl]);
+}
@@ -0,0 +1,55 @@
+#ifndef __TLSF_H__
+#define __TLSF_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// TLSF（二段の分離適合）アロケーター：可変長メモリープールの中身
+//   空きブロックを大きさの 2 のべき乗（第一段）とそれを 16 等分した区間（第二段）ごとのリストに分け、
+//   空でないリストをビットマップで持つ。取得は要求を区間の上端に切り上げてビット検索で一つ選び、
+//   返却は物理的に隣の空きブロックと結合する。どちらもリストの長さに依らず定数時間。
+//   各ブロックの前にはサイズのヘッダー（ポインタ一つ分）が付き、ペイロードはポインタ境界にそろう。
+//   排他は持たない（呼び出しはディスパッチャーのスレッドだけ）。
+
+#define TLSF_SL_INDEX_COUNT_LOG2	4
+#define TLSF_SL_INDEX_COUNT			(1 << TLSF_SL_INDEX_COUNT_LOG2)
+#define TLSF_ALIGN_SIZE_LOG2		((sizeof(void*) == 8) ? 3 : 2)
+#define TLSF_ALIGN_SIZE				(1 << TLSF_ALIGN_SIZE_LOG2)
+// 第一段の 0 番は TLSF_SMALL_BLOCK_SIZE 未満を TLSF_ALIGN_SIZE ごとに分ける
+#define TLSF_FL_INDEX_SHIFT			(TLSF_SL_INDEX_COUNT_LOG2 + TLSF_ALIGN_SIZE_LOG2)
+#define TLSF_SMALL_BLOCK_SIZE		(1 << TLSF_FL_INDEX_SHIFT)
+// 扱える大きさは 2^TLSF_FL_INDEX_MAX 未満
+#define TLSF_FL_INDEX_MAX			((sizeof(size_t) == 8) ? 32 : 30)
+#define TLSF_FL_INDEX_COUNT			(TLSF_FL_INDEX_MAX - TLSF_FL_INDEX_SHIFT + 1)
+
+struct TlsfBlock;
+
+struct Tlsf {
+	uint32_t flBitmap;
+	uint32_t slBitmap[TLSF_FL_INDEX_COUNT];
+	TlsfBlock* blocks[TLSF_FL_INDEX_COUNT][TLSF_SL_INDEX_COUNT];
+	char* area;				// 管理している領域
+	size_t areaSize;
+	size_t capacity;		// 初期化直後の空き（一度に取得できる最大の大きさ）
+	size_t freeBytes;		// 空きブロックのペイロードの合計
+	size_t minFreeBytes;	// freeBytes の最小値
+	size_t freeBlocks;		// 空きブロックの数
+};
+
+struct TlsfStats {
+	size_t freeBytes;
+	size_t minFreeBytes;
+	size_t freeBlocks;
+	size_t largestFree;		// 最大の空きブロック
+	size_t allocatable;		// 今この大きさまでなら必ず取得できる
+};
+
+// mem はポインタ境界に置くこと（小さすぎて一つもブロックを作れなければ false）
+bool TlsfInit(Tlsf* tlsf, void* mem, size_t bytes);
+// 取れなければ nullptr（size == 0 も nullptr）
+void* TlsfAlloc(Tlsf* tlsf, size_t size);
+// TlsfAlloc で取得したブロックでなければ何もせず false
+bool TlsfFree(Tlsf* tlsf, void* ptr);
+void TlsfGetStats(const Tlsf* tlsf, TlsfStats* stats);
+
+#endif // __TLSF_H__
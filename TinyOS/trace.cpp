@@ -0,0 +1,144 @@
+#include "trace.h"
+
+#if TRACE_BUFFER_SIZE > 0
+
+TraceRecord traceBuffer[TRACE_BUFFER_SIZE];
+uint64_t traceCount;
+
+static const char* WaitReasonName(UINT reason) {
+	switch (reason) {
+	case 0:			return "activate";	// 生成直後の起動
+	case TTW_SLP:	return "sleep";
+	case TTW_DLY:	return "delay";
+	case TTW_SEM:	return "semaphore";
+	case TTW_FLG:	return "flag";
+	case TTW_SDTQ:	return "send dtq";
+	case TTW_RDTQ:	return "receive dtq";
+	case TTW_MTX:	return "mutex";
+	case TTW_MPF:	return "fixed memory pool";
+	case TTW_MPL:	return "variable memory pool";
+	default:		return "other";
+	}
+}
+
+// 非タスクとディスパッチャーはスレッド 0、タスクは ID + 1
+static int TraceTid(ID tskid) {
+	return (tskid >= 0) ? tskid + 1 : 0;
+}
+
+static void JsonString(FILE* fp, const char* str) {
+	fputc('"', fp);
+	for (; str && *str; str++) {
+		unsigned char c = static_cast<unsigned char>(*str);
+		if (c == '"' || c == '\\') fprintf(fp, "\\%c", c);
+		else if (c < 0x20) fprintf(fp, "\\u%04x", c);
+		else fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+// Chrome trace の時刻はマイクロ秒
+static double TraceUs(uint64_t time, uint64_t base) {
+	return static_cast<double>(time - base) / 1000.0;
+}
+
+bool TraceExportChrome(FILE* fp, const char* (*taskName)(ID tskid)) {
+	uint64_t count = (traceCount < TRACE_BUFFER_SIZE) ? traceCount : TRACE_BUFFER_SIZE;
+	uint64_t first = traceCount - count;
+	uint64_t base = count ? traceBuffer[first & (TRACE_BUFFER_SIZE - 1)].time : 0;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"TinyOS\"}}");
+	fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"non-task\"}}");
+	for (ID tskid = 0; tskid < ID_TASK_MAX; tskid++) {
+		const char* name = taskName(tskid);
+		if (!name) continue;
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", TraceTid(tskid));
+		JsonString(fp, name);
+		fprintf(fp, "}}");
+	}
+
+	// 実行区間はディスパッチから戻るまで、待ち区間は待ちに入ってから解除されるまでの完了イベントにする
+	// （バッファが一周して始まりが残っていない区間は出さない）
+	ID running = TSK_NONE;
+	uint64_t runStart = 0;
+	uint64_t handlerStart = 0;	// 0 なら始まりが残っていない
+	bool blocked[ID_TASK_MAX] = {};
+	uint64_t blockStart[ID_TASK_MAX] = {};
+
+	for (uint64_t i = first; i < traceCount; i++) {
+		const TraceRecord& record = traceBuffer[i & (TRACE_BUFFER_SIZE - 1)];
+		double ts = TraceUs(record.time, base);
+		int tid = TraceTid(record.source);
+		bool isTask = record.id >= 0 && record.id < ID_TASK_MAX;
+
+		switch (record.type) {
+		case TRACE_DISPATCH:
+			running = record.id;
+			runStart = record.time;
+			break;
+		case TRACE_YIELD:
+		case TRACE_BLOCK:
+		case TRACE_EXIT:
+			if (running == record.id) {
+				const char* end = (record.type == TRACE_BLOCK) ? WaitReasonName(record.reason)
+					: (record.type == TRACE_EXIT) ? "exit"
+					: record.data ? "preempted" : "yield";
+				fprintf(fp, ",\n{\"name\":\"run\",\"cat\":\"sched\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"end\":\"%s\"}}",
+					TraceTid(record.id), TraceUs(runStart, base), TraceUs(record.time, runStart), end);
+			}
+			running = TSK_NONE;
+			if (record.type == TRACE_BLOCK && isTask) {
+				blocked[record.id] = true;
+				blockStart[record.id] = record.time;
+			}
+			break;
+		case TRACE_WAKEUP:
+			if (isTask && blocked[record.id]) {
+				fprintf(fp, ",\n{\"name\":\"wait %s\",\"cat\":\"wait\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"ercd\":%d,\"by\":%d}}",
+					WaitReasonName(record.reason), TraceTid(record.id), TraceUs(blockStart[record.id], base),
+					TraceUs(record.time, blockStart[record.id]), static_cast<ER>(record.data), record.source);
+				blocked[record.id] = false;
+			}
+			fprintf(fp, ",\n{\"name\":\"wakeup\",\"cat\":\"wait\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"task\":%d,\"reason\":\"%s\"}}",
+				tid, ts, record.id, WaitReasonName(record.reason));
+			break;
+		case TRACE_FLAG_SET:
+			fprintf(fp, ",\n{\"name\":\"flag set\",\"cat\":\"flag\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"flgid\":%d,\"flgptn\":%u}}",
+				tid, ts, record.id, record.data);
+			break;
+		case TRACE_DTQ_SEND:
+		case TRACE_DTQ_RECEIVE:
+			fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"dtq\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"dtqid\":%d,\"data\":%u}}",
+				(record.type == TRACE_DTQ_SEND) ? "dtq send" : "dtq receive", tid, ts, record.id, record.data);
+			break;
+		case TRACE_TIMER_EXPIRE:
+			fprintf(fp, ",\n{\"name\":\"timer expire\",\"cat\":\"timer\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"task\":%d}}",
+				tid, ts, record.id);
+			break;
+		case TRACE_HANDLER_ENTER:
+			handlerStart = record.time;
+			break;
+		case TRACE_HANDLER_EXIT:
+			// ハンドラーは入れ子にならないので、直前の ENTER と組にする
+			if (handlerStart) {
+				fprintf(fp, ",\n{\"name\":\"%s %d\",\"cat\":\"handler\",\"ph\":\"X\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}",
+					(record.reason == TRACE_HANDLER_ALARM) ? "alarm" : "cyclic", record.id,
+					TraceUs(handlerStart, base), TraceUs(record.time, handlerStart));
+			}
+			handlerStart = 0;
+			break;
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+	return !ferror(fp);
+}
+
+#else
+
+bool TraceExportChrome(FILE*, const char* (*)(ID)) {
+	return false;
+}
+
+#endif // TRACE_BUFFER_SIZE > 0
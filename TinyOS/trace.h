@@ -0,0 +1,77 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <cstdint>
+#include <cstdio>
+
+#include "kernel.h"
+#include "port.h"
+#include "kernelConfig.h"
+
+// カーネルトレース：固定長のバイナリレコードをリングバッファに書き、古いものから上書きする
+// 記録はディスパッチャーのスレッドだけが行うので排他は要らない（時刻の取得とストアだけ）
+// 書き出し（exportTraceTinyOS）は実行後にまとめて Chrome trace JSON に変換する
+
+// リングバッファのレコード数（2 のべき乗、userConfig.h で 0 にするとトレースのコードは消える）
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE	4096
+#endif
+
+enum TraceType {
+	TRACE_DISPATCH,			// id のタスクに実行権を渡した
+	TRACE_YIELD,			// id のタスクがレディーのまま戻った（data = 1 なら横取り）
+	TRACE_BLOCK,			// id のタスクが待ちに入った（reason = TTW_*）
+	TRACE_EXIT,				// id のタスクが終了した
+	TRACE_WAKEUP,			// id のタスクの待ちを解除した（reason = TTW_*、data = 待っていた呼び出しの戻り値）
+	TRACE_FLAG_SET,			// id のフラグにパターンを設定した（data = 設定後のパターン）
+	TRACE_DTQ_SEND,			// id のデータキューに送った（data = データの下位 32 ビット）
+	TRACE_DTQ_RECEIVE,		// id のデータキューから受け取った（data = データの下位 32 ビット）
+	TRACE_TIMER_EXPIRE,		// id のタスクの時間待ちが満了した
+	TRACE_HANDLER_ENTER,	// id のハンドラーを呼んだ（reason = TRACE_HANDLER_*）
+	TRACE_HANDLER_EXIT,		// id のハンドラーから戻った（reason = TRACE_HANDLER_*）
+};
+
+// TRACE_HANDLER_ENTER / EXIT の reason
+#define TRACE_HANDLER_CYCLIC	0
+#define TRACE_HANDLER_ALARM		1
+
+// source は記録したときに動いていたタスク（非タスクやディスパッチャーなら TSK_NONE）
+struct TraceRecord {
+	uint64_t time;			// PortTimestamp() のナノ秒
+	uint8_t type;
+	uint16_t reason;
+	ID id;
+	ID source;
+	UINT data;
+};
+
+#if TRACE_BUFFER_SIZE > 0
+
+static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0, "TRACE_BUFFER_SIZE must be a power of two");
+
+extern TraceRecord traceBuffer[TRACE_BUFFER_SIZE];
+extern uint64_t traceCount;		// これまでに記録した数（バッファの長さを超えたら古いものから上書き）
+
+static inline void TraceEvent(TraceType type, ID id, ID source, UINT reason, UINT data) {
+	TraceRecord* record = &traceBuffer[traceCount++ & (TRACE_BUFFER_SIZE - 1)];
+	record->time = PortTimestamp();
+	record->type = static_cast<uint8_t>(type);
+	record->reason = static_cast<uint16_t>(reason);
+	record->id = id;
+	record->source = source;
+	record->data = data;
+}
+
+#define TRACE(type, id, source, reason, data)	TraceEvent(type, id, source, reason, data)
+
+#else
+
+#define TRACE(type, id, source, reason, data)	((void)0)
+
+#endif // TRACE_BUFFER_SIZE > 0
+
+// バッファに残っているレコードを Chrome trace JSON（Perfetto でも読める）で書き出す
+// タスクはそれぞれ一つのスレッドとして、実行区間と待ちの理由を並べる
+bool TraceExportChrome(FILE* fp, const char* (*taskName)(ID tskid));
+
+#endif // __TRACE_H__
@@ -1,81 +1,156 @@
+#include <cstdint>
+
 #include "TinyOS.h"
 #include "kernel.h"
+#include "staticConfig.h"
 #include "userConfig.h"
 
-int configTinyOS() {
-
-	CreteFlag(ID_FLAG_AAA, "Flag 1", 0x00);
-
-	CreateDataQueue(ID_DTQ_AAA, "DataQueue 1");
-	CreateDataQueue(ID_DTQ_BBB, "DataQueue 2");
-	CreateDataQueue(ID_DTQ_CCC, "DataQueue 3");
+// 非タスクからの呼び出しを模擬する周期ハンドラー
+static void StimulusHandler(VP_INT) {
+	static int count = 0;
+	switch (count++) {
+	case 0:
+		debug_printf("ActionTask(ID_MMM)\n");
+		iWakeupTask(ID_TASK_MMM);
+		break;
+	case 1:
+		// wait
+		break;
+	case 2:
+		debug_printf("iSendDataQueue(ID_CCC, 765)\n");
+		iSendDataQueue(ID_DTQ_CCC, (VP_INT)765);
+		break;
+	case 3:
+		debug_printf("iSetFlag(ID_AAA, 0x01)\n");
+		iSetFlag(ID_FLAG_AAA, 0x01);
+		break;
+	case 4:
+		debug_printf("iSetFlag(ID_AAA, 0x02)\n");
+		iSetFlag(ID_FLAG_AAA, 0x02);
+		break;
+	default:
+		debug_printf("count = 0\n");
+		count = 0;
+		break;
+	}
+}
 
-	// ユーザー定義タスクを作成
-	CreateTask(ID_TASK_AAA, "Task 1", [](VP_INT) {
-		TASK_FOREVER {
-			VP_INT dtq_data;
-			int data;
-			ReceiveDataQueue(ID_DTQ_AAA, &dtq_data);
-			data = (int)dtq_data;
-			debug_printf("Task 1 recept data: %d\n", data);
-			if (data == 123) {
-				DelayTask(3);
-				debug_printf("Task 1 is setting flag.\n");
-				SetFlag(ID_FLAG_AAA, 0x01);
-			}
+static void Task1(VP_INT) {
+	TASK_FOREVER {
+		VP_INT dtq_data;
+		int data;
+		if (ReceiveDataQueue(ID_DTQ_AAA, &dtq_data) != E_OK) continue;
+		data = (int)(intptr_t)dtq_data;
+		debug_printf("Task 1 recept data: %d\n", data);
+		if (data == 123) {
+			DelayTask(3);
+			debug_printf("Task 1 is setting flag.\n");
+			SetFlag(ID_FLAG_AAA, 0x01);
 		}
-	}, NULL);
-
-	CreateTask(ID_TASK_BBB, "Task 2", [](VP_INT) {
-		TASK_FOREVER {
-			VP_INT dtq_data;
-			int data;
-			ReceiveDataQueue(ID_DTQ_BBB, &dtq_data);
-			data = (int)dtq_data;
-			debug_printf("Task 2 recept data: %d\n", data);
-			if (data == 456) {
-				DelayTask(5);
-				debug_printf("Task 2 is setting flag.\n");
-				SetFlag(ID_FLAG_AAA, 0x02);
-			}
+	}
+}
+
+static void Task2(VP_INT) {
+	TASK_FOREVER {
+		VP_INT dtq_data;
+		int data;
+		if (ReceiveDataQueue(ID_DTQ_BBB, &dtq_data) != E_OK) continue;
+		data = (int)(intptr_t)dtq_data;
+		debug_printf("Task 2 recept data: %d\n", data);
+		if (data == 456) {
+			DelayTask(5);
+			debug_printf("Task 2 is setting flag.\n");
+			SetFlag(ID_FLAG_AAA, 0x02);
 		}
-	}, NULL);
-
-	CreateTask(ID_TASK_CCC, "Task 3", [](VP_INT) {
-		TASK_FOREVER {
-			VP_INT dtq_data;
-			int data;
-			debug_printf("Task 3 is waiting for data.\n");
-			ReceiveDataQueue(ID_DTQ_CCC, &dtq_data);
-			data = (int)dtq_data;
-			debug_printf("Task 3 recept data: %d\n", data);
-			if (data >= 700) {
-				if (data == 789) {
-					debug_printf("Task 3 is sending data.\n");
-					pSendDataQueue(ID_DTQ_AAA, (VP_INT)123);
-		
-					debug_printf("Task 3 is sending data.\n");
-					pSendDataQueue(ID_DTQ_BBB, (VP_INT)456);
-				}
-				FLGPTN resultFlag;
-				debug_printf("Task 3 is waiting for flag.\n");
-				WaitFlg(ID_FLAG_AAA, 0x01|0x02, TWF_ANDW, &resultFlag);
-				ClearFlag(ID_FLAG_AAA, ~(0x01|0x02));
-				debug_printf("Task 3 acquired flag: %d\n", resultFlag);
+	}
+}
+
+static void Task3(VP_INT) {
+	TASK_FOREVER {
+		VP_INT dtq_data;
+		int data;
+		debug_printf("Task 3 is waiting for data.\n");
+		if (ReceiveDataQueue(ID_DTQ_CCC, &dtq_data) != E_OK) continue;
+		data = (int)(intptr_t)dtq_data;
+		debug_printf("Task 3 recept data: %d\n", data);
+		if (data >= 700) {
+			if (data == 789) {
+				debug_printf("Task 3 is sending data.\n");
+				pSendDataQueue(ID_DTQ_AAA, (VP_INT)123);
+
+				debug_printf("Task 3 is sending data.\n");
+				pSendDataQueue(ID_DTQ_BBB, (VP_INT)456);
 			}
+			FLGPTN resultFlag;
+			debug_printf("Task 3 is waiting for flag.\n");
+			WaitFlg(ID_FLAG_AAA, 0x01|0x02, TWF_ANDW, &resultFlag);
+			ClearFlag(ID_FLAG_AAA, ~(0x01|0x02));
+			debug_printf("Task 3 acquired flag: %d\n", resultFlag);
 		}
-	}, NULL);
+	}
+}
 
-	CreateTask(ID_TASK_MMM, "Task Master", [](VP_INT) {
-		TASK_FOREVER {
-			debug_printf("Task Master is sleeping...\n");
-			SleepTask();
-			debug_printf("Task Master is awake!\n");
+static void TaskMaster(VP_INT) {
+	TASK_FOREVER {
+		debug_printf("Task Master is sleeping...\n");
+		SleepTask();
+		debug_printf("Task Master is awake!\n");
 
-			debug_printf("Task Master is sending data.\n");
-			pSendDataQueue(ID_DTQ_CCC, (VP_INT)789);
-		}
-	}, NULL);
+		debug_printf("Task Master is sending data.\n");
+		pSendDataQueue(ID_DTQ_CCC, (VP_INT)789);
+	}
+}
+
+// スタック・キュー・メモリープールの領域（すべて静的に確保し、起動時にヒープを使わない）
+alignas(16) static char stackTask1[16 * 1024];
+alignas(16) static char stackTask2[16 * 1024];
+alignas(16) static char stackTask3[16 * 1024];
+alignas(16) static char stackTaskMaster[16 * 1024];
+static VP_INT bufferDtq1[4];
+static VP_INT bufferDtq2[4];
+static VP_INT bufferDtq3[4];
+alignas(void*) static char areaMpf1[4 * 32];
+alignas(void*) static char areaMpl1[1024];
+
+static constexpr StaticTask staticTasks[] = {
+	StaticTaskEntry(ID_TASK_AAA, "Task 1", Task1, NULL, 3, 0, stackTask1),
+	StaticTaskEntry(ID_TASK_BBB, "Task 2", Task2, NULL, 3, 0, stackTask2),
+	StaticTaskEntry(ID_TASK_CCC, "Task 3", Task3, NULL, 2, 0, stackTask3),
+	StaticTaskEntry(ID_TASK_MMM, "Task Master", TaskMaster, NULL, 1, 0, stackTaskMaster),
+};
+static_assert(StaticTableValid(staticTasks, ID_TASK_MAX), "staticTasks must list every id_task in order");
+
+static constexpr StaticFlag staticFlags[] = {
+	{ ID_FLAG_AAA, "Flag 1", TA_WMUL, 0x00 },
+};
+static_assert(StaticTableValid(staticFlags, ID_FLAG_MAX), "staticFlags must list every id_flag in order");
+
+static constexpr StaticDataQueue staticDataQueues[] = {
+	StaticDataQueueEntry(ID_DTQ_AAA, "DataQueue 1", bufferDtq1),
+	StaticDataQueueEntry(ID_DTQ_BBB, "DataQueue 2", bufferDtq2),
+	StaticDataQueueEntry(ID_DTQ_CCC, "DataQueue 3", bufferDtq3),
+};
+static_assert(StaticTableValid(staticDataQueues, ID_DTQ_MAX), "staticDataQueues must list every id_dtq in order");
+
+// どれか一つでも生成できなければ、そのエラーコードを返して起動を止める
+int configTinyOS() {
+	ER ercd;
+
+	if ((ercd = CreateStaticFlags(staticFlags)) != E_OK) return ercd;
+	if ((ercd = CreateStaticDataQueues(staticDataQueues)) != E_OK) return ercd;
+
+	if ((ercd = CreateSemaphore(ID_SEM_AAA, "Semaphore 1", 0, 4)) != E_OK) return ercd;
+
+	if ((ercd = CreateFixedMemoryPool(ID_MPF_AAA, "MemoryPool 1", 4, 32, areaMpf1)) != E_OK) return ercd;
+	if ((ercd = CreateVariableMemoryPool(ID_MPL_AAA, "MemoryPool 2", sizeof(areaMpl1), areaMpl1)) != E_OK) return ercd;
+
+	if ((ercd = CreateMutex(ID_MTX_AAA, "Mutex 1", TA_INHERIT, 0)) != E_OK) return ercd;
+
+	// 既定のティック（500 ミリ秒）で 10 秒ごと
+	if ((ercd = CreateCyclicHandler(ID_CYC_STIMULUS, "Stimulus", TA_STA, StimulusHandler, NULL, 20, 20)) != E_OK) return ercd;
+
+	// ユーザー定義タスクを作成
+	if ((ercd = CreateStaticTasks(staticTasks)) != E_OK) return ercd;
 
 	return 0;
 }
@@ -1,6 +1,17 @@
 #ifndef __USER_CONFIG_H__
 #define __USER_CONFIG_H__
 
+// 1ティックあたりのディスパッチ回数の上限（超えた分は次のティックに持ち越す）
+#define DISPATCH_BUDGET		64
+
+// ログのレベルとカテゴリー（kernelLog.h の KLOG_LEVEL_* と KLOG_CAT_*）
+// KLOG_LEVEL_DEBUG はディスパッチのたびに記録するので、調べるときだけ指定する
+#define KLOG_LEVEL			KLOG_LEVEL_INFO
+#define KLOG_CATEGORIES		KLOG_CAT_ALL
+
+// カーネルトレースのレコード数（2 のべき乗、0 ならトレースしない）
+#define TRACE_BUFFER_SIZE	4096
+
 enum id_task {
 	ID_TASK_AAA,
 	ID_TASK_BBB,
@@ -24,4 +35,39 @@ enum id_dtq {
 	ID_DTQ_MAX
 };
 
+enum id_sem {
+	ID_SEM_AAA,
+	/* --- */
+	ID_SEM_MAX
+};
+
+enum id_mpf {
+	ID_MPF_AAA,
+	/* --- */
+	ID_MPF_MAX
+};
+
+enum id_mpl {
+	ID_MPL_AAA,
+	/* --- */
+	ID_MPL_MAX
+};
+
+enum id_mtx {
+	ID_MTX_AAA,
+	/* --- */
+	ID_MTX_MAX
+};
+
+enum id_cyc {
+	ID_CYC_STIMULUS,
+	/* --- */
+	ID_CYC_MAX
+};
+
+enum id_alm {
+	/* --- */
+	ID_ALM_MAX
+};
+
 #endif // __USER_CONFIG_H__